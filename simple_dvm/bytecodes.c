@@ -8,27 +8,22 @@
 #include "simple_dvm.h"
 #include "java_lib.h"
 
-encoded_method *find_method(DexFileFormat *dex, int class_idx, int method_name_idx);
+encoded_method *find_method(DexFileFormat *dex, int method_id);
 encoded_method *find_method_by_name(DexFileFormat *dex, int class_idx, const char *name);
-encoded_method *find_vmethod(DexFileFormat *dex, instance_obj *ins_obj, int class_idx, int method_name_idx);
+encoded_method *find_vmethod(DexFileFormat *dex, instance_obj *ins_obj, int method_id);
 static int invoke_method(char *name, DexFileFormat *dex, simple_dalvik_vm *vm, method_id_item *m, invoke_parameters *p);
-int new_invoke_frame(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m);
-void stack_push(simple_dalvik_vm *vm, u4 data);
-u4 stack_pop(simple_dalvik_vm *vm);
+static int invoke_encoded_method(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *method, invoke_parameters *p);
+int new_invoke_frame(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m, invoke_parameters *p);
 static int op_utils_invoke_35c_parse(DexFileFormat *dex, u1 *ptr, int *pc,
                                      invoke_parameters *p);
 
 static int find_const_string(DexFileFormat *dex, char *entry)
 {
-    int i = 0;
-    for (i = 0; i < dex->header.stringIdsSize; i++) {
-        if (memcmp(dex->string_data_item[i].data, entry, strlen(entry)) == 0) {
-            if (is_verbose())
-                printf("find %s in dex->string_data_item[%d]\n", entry, i);
-            return i;
-        }
-    }
-    return -1;
+    int i = find_string_id(dex, entry);
+
+    if (i >= 0 && is_verbose())
+        printf("find %s in dex->string_data_item[%d]\n", entry, i);
+    return i;
 }
 
 static void op_utils_move(simple_dalvik_vm *vm, int reg_idx_vx, int reg_idx_vy)
@@ -129,33 +124,24 @@ static int op_move_result_object(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *p
 }
 
 /*
- * Pop registers from the stack in vm to restore calling frame,
- * then set the flag returned to be 1 to notify the module running 
- * instructions (e.g., the function runMethod().)
+ * Pop the frame of the returning method and its register window to restore
+ * calling frame.  The interpreter loop (runMethod()) notices the change of
+ * call depth and resumes the caller at its return pc.
  */
 static int op_utils_return(simple_dalvik_vm *vm)
 {
-	int reg_size;
-	int idx;
-
-	/* step 1: Update current sp */
-	vm->sp = vm->fp;
+	vm_frame *frame = vm->fp;
 
-	/* step 2: Pop caller registers */
-	reg_size = stack_pop(vm);
-	for (idx = reg_size - 1; idx >= 0; idx--)
-	{
-		u4 value;
-
-		value = stack_pop(vm);
-		store_to_reg(vm, idx, (u1 *)&value);
-	}
+	/* step 1: Pop the frame record */
+	vm->frame_count--;
+	vm->fp = vm->frame_count ? frame - 1 : NULL;
 
-	/* step 3: Pop fp & pc */
-	vm->fp = (u1 *) stack_pop(vm);
-	vm->pc = stack_pop(vm);
+	/* step 2: Release the callee window, switch back to the caller's */
+	vm->reg_top = frame->regs;
+	vm->regs = vm->reg_stack + (vm->fp ? vm->fp->regs : 0);
 
-	vm->returned = 1;
+	/* step 3: Resume the caller */
+	vm->pc = frame->return_pc;
 
 	return 0;
 }
@@ -236,7 +222,7 @@ static int op_const_4(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc
         value = 0x0F - value + 1;
         value = -value;
     }
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &value);
+    set_reg_int(vm, reg_idx_vx, value);
     if (is_verbose())
         printf("const/4 v%d, #int%d\n", reg_idx_vx , value);
     *pc = *pc + 2;
@@ -255,7 +241,7 @@ static int op_const_16(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *p
     reg_idx_vx = ptr[*pc + 1];
     value = (ptr[*pc + 3] << 8 | ptr[*pc + 2]);
 
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &value);
+    set_reg_int(vm, reg_idx_vx, value);
     if (is_verbose())
         printf("const/16 v%d, #int%d\n", reg_idx_vx, value);
     *pc = *pc + 4;
@@ -274,7 +260,7 @@ static int op_const(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
     reg_idx_vx = ptr[*pc + 1];
     value = (ptr[*pc + 5] << 24 | ptr[*pc + 4] << 16 | ptr[*pc + 3] << 8 | ptr[*pc + 2]);
 
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &value);
+    set_reg_int(vm, reg_idx_vx, value);
     if (is_verbose())
         printf("const v%d, #int%d\n", reg_idx_vx, value);
     *pc = *pc + 6;
@@ -291,13 +277,11 @@ static int op_const_wide_16(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
 {
 	long long value = 0;
     int reg_idx_vx = 0;
-    unsigned char *ptr_value = (unsigned char *) &value;
     reg_idx_vx = ptr[*pc + 1];
 	value = (short) (ptr[*pc + 3] << 8 | ptr[*pc + 2]);
     if (is_verbose())
         printf("const-wide/16 v%d, #int %lld\n", reg_idx_vx, value);
-    store_double_to_reg(vm, reg_idx_vx, ptr_value + 4);
-    store_double_to_reg(vm, reg_idx_vx + 1, ptr_value);
+    set_reg_long(vm, reg_idx_vx, value);
     *pc = *pc + 4;
     return 0;
 }
@@ -312,13 +296,11 @@ static int op_const_wide_32(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
 {
 	long long value = 0;
     int reg_idx_vx = 0;
-    unsigned char *ptr_value = (unsigned char *) &value;
     reg_idx_vx = ptr[*pc + 1];
 	value = (int) (ptr[*pc + 5] << 24 | ptr[*pc + 4] << 16 | ptr[*pc + 3] << 8 | ptr[*pc + 2]);
     if (is_verbose())
         printf("const-wide/32 v%d, #long %lld\n", reg_idx_vx, value);
-    store_double_to_reg(vm, reg_idx_vx, ptr_value + 4);
-    store_double_to_reg(vm, reg_idx_vx + 1, ptr_value);
+    set_reg_long(vm, reg_idx_vx, value);
     *pc = *pc + 6;
     return 0;
 }
@@ -333,15 +315,12 @@ static int op_const_wide_32(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
 static int op_const_wide_high16(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
     long long value = 0L;
-    unsigned char *ptr2 = (unsigned char *) &value;
     int reg_idx_vx = 0;
     reg_idx_vx = ptr[*pc + 1];
-    ptr2[1] = ptr[*pc + 3];
-    ptr2[0] = ptr[*pc + 2];
+    value = (long long) (ptr[*pc + 3] << 8 | ptr[*pc + 2]) << 48;
     if (is_verbose())
         printf("const-wide/hight16 v%d, #long %lld\n", reg_idx_vx, value);
-    store_to_reg(vm, reg_idx_vx, ptr2);
-    value = 1L;
+    set_reg_long(vm, reg_idx_vx, value);
     *pc = *pc + 4;
     return 0;
 }
@@ -355,7 +334,6 @@ static int op_const_string(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
 {
     int reg_idx_vx = 0;
     int string_id = 0;
-	char *c_str = NULL;
 	String *s = NULL;
 
     reg_idx_vx = ptr[*pc + 1];
@@ -365,8 +343,9 @@ static int op_const_string(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
         printf("const-string v%d, string_id 0x%04x\n",
                reg_idx_vx , string_id);
 
-	c_str = get_string_data(dex, string_id);
-	s = java_lang_string_const_string(dex, vm, c_str, strlen(c_str));
+	s = java_lang_string_intern(dex, vm, string_id);
+	if (!s)
+		return -1;
 
     store_to_reg(vm, reg_idx_vx, (unsigned char *) &s);
     *pc = *pc + 4;
@@ -446,21 +425,9 @@ class_def_item *find_class_def_by_name(DexFileFormat *dex, char *class_name)
 
 class_def_item *find_class_def(DexFileFormat *dex, int type_id)
 {
-	int i;
-	class_def_item *found = NULL;
-
-	for (i = 0; i < dex->header.classDefsSize; i++)
-	{
-		class_def_item *item = &dex->class_def_item[i];
-
-		if (item->class_idx == type_id)
-		{
-			found = item;
-			break;
-		}
-	}
+	int idx = get_class_def_index(dex, type_id);
 
-	return found;
+	return (idx < 0) ? NULL : &dex->class_def_item[idx];
 }
 
 /*
@@ -489,47 +456,37 @@ class_data_item *find_class_data_by_name(DexFileFormat *dex, char *class_name)
 
 class_data_item *find_class_data(DexFileFormat *dex, int type_id)
 {
-	int i;
-	class_data_item *found = NULL;
-
-	for (i = 0; i < dex->header.classDefsSize; i++)
-	{
-		class_data_item *class_data = &dex->class_data_item[i];
-		class_def_item *item = &dex->class_def_item[i];
+	int idx = get_class_def_index(dex, type_id);
 
-		if (item->class_idx == type_id)
-		{
-			found = class_data;
-			break;
-		}
-	}
-
-	return found;
+	return (idx < 0) ? NULL : get_class_data_item(dex, idx);
 }
 
 class_obj *find_class_obj(simple_dalvik_vm *vm, char *name)
 {
-	class_obj *obj = NULL, *found = NULL;
-	struct list_head *p, *list;
-
     if (strncmp(name, "Ljava", strlen("Ljava")) == 0)
 	    return find_java_class_obj(vm, name);
 
-	list = hash_get(&vm->root_set, hash(name));
-	if (!list)
-		return NULL;
+	return (class_obj *) hash_get(&vm->root_set, hash(name), name);
+}
 
-	foreach(p, list)
-	{
-		obj = (class_obj *) container_of(p, class_obj, class_list);
-		if (strncmp(name, obj->name, strlen(name)) == 0)
-		{
-			found = obj;
-			break;
-		}
-	}
+/*
+ * find_class_obj() by type_id.  Class objects are cached per type_id once
+ * found or created, so only the first lookup of a type hashes its name.
+ */
+class_obj *find_class_obj_by_type(simple_dalvik_vm *vm, DexFileFormat *dex, int type_id)
+{
+	if (type_id < 0 || type_id >= vm->type_class_obj_size)
+		return find_class_obj(vm, get_type_item_name(dex, type_id));
 
-	return found;
+	if (!vm->type_class_obj[type_id])
+		vm->type_class_obj[type_id] = find_class_obj(vm, get_type_item_name(dex, type_id));
+	return vm->type_class_obj[type_id];
+}
+
+static void cache_class_obj(simple_dalvik_vm *vm, int type_id, class_obj *obj)
+{
+	if (type_id >= 0 && type_id < vm->type_class_obj_size)
+		vm->type_class_obj[type_id] = obj;
 }
 
 //int get_type_size(char *type_str)
@@ -556,85 +513,187 @@ class_obj *find_class_obj(simple_dalvik_vm *vm, char *name)
 //		return 4;
 //}
 
-/* This function sholud be called after obj->parent is initialized */
-static void fill_vtable(DexFileFormat *dex, class_obj *obj, class_data_item *class_data)
+/* Two method ids name the same virtual method if name and prototype match */
+static int same_method_sig(DexFileFormat *dex, uint method_id1, uint method_id2)
+{
+	method_id_item *m1 = get_method_item(dex, method_id1);
+	method_id_item *m2 = get_method_item(dex, method_id2);
+
+	/* string_ids and proto_ids are unique within a dex, so the indices can be compared */
+	return m1->name_idx == m2->name_idx && m1->proto_idx == m2->proto_idx;
+}
+
+/*
+ * Build the method_id -> vtable slot map of a class.
+ *
+ * method_ids are sorted by class_idx, so the ids that name a method through
+ * this class form one contiguous range; each of them maps to the slot of
+ * the matching vtable entry, or -1 if it is not a virtual method.
+ */
+static void fill_vtable_map(DexFileFormat *dex, class_obj *obj, int class_idx)
+{
+	int lo = 0, hi = dex->header.methodIdsSize;
+	int i, j;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+
+		if (dex->method_id_item[mid].class_idx < class_idx)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (hi = lo; hi < dex->header.methodIdsSize; hi++)
+		if (dex->method_id_item[hi].class_idx != class_idx)
+			break;
+
+	obj->vtable_map_base = lo;
+	obj->vtable_map_size = hi - lo;
+	if (obj->vtable_map_size == 0)
+		return;
+	obj->vtable_map = malloc(sizeof(int) * obj->vtable_map_size);
+
+	for (i = 0; i < obj->vtable_map_size; i++)
+	{
+		obj->vtable_map[i] = -1;
+		for (j = 0; j < obj->vtable_size; j++)
+		{
+			if (same_method_sig(dex, lo + i, obj->vtable[j].method_id))
+			{
+				obj->vtable_map[i] = j;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * This function sholud be called after obj->parent is initialized.
+ *
+ * The parent's vtable is inherited slot for slot: an overriding method
+ * replaces the parent entry in place, new virtual methods are appended.
+ * So a slot resolved against a class is valid for all of its subclasses.
+ */
+static void fill_vtable(DexFileFormat *dex, class_obj *obj, class_def_item *class_def, class_data_item *class_data)
 {
 	int parent_vtable_size = (obj->parent == NULL) ? 0 : obj->parent->vtable_size;
 	int this_vmethods_size = class_data->virtual_methods_size;
-	vtable_item *parent_vtable = (obj->parent == NULL) ? NULL : obj->parent->vtable;
-	vtable_item **non_overridden_pvtable_entries = NULL;
-	int overridden_size = 0;
-	int non_overridden_size = 0;
+	int aggregated_idx = 0;
 	int i = 0, j = 0;
 
 	if (is_verbose())
 		printf("Filling vtable for %s...\n", obj->name);
 
-	/* Step 1: Calculate the vtable size for this class 
-	 *         and record those parent vtable entries are not overridden by this class */
-	non_overridden_pvtable_entries = malloc(sizeof(vtable_item*) * parent_vtable_size);
-	for (i = 0; i < parent_vtable_size; i++)
+	obj->vtable = malloc(sizeof(vtable_item) * (parent_vtable_size + this_vmethods_size));
+	if (parent_vtable_size)
+		memcpy(obj->vtable, obj->parent->vtable, sizeof(vtable_item) * parent_vtable_size);
+	obj->vtable_size = parent_vtable_size;
+
+	for (i = 0; i < this_vmethods_size; i++)
 	{
-		int aggregated_idx = 0;
-		int tmp_overridden_size = overridden_size;
+		aggregated_idx += class_data->virtual_methods[i].method_idx_diff;
 
-		for (j = 0; j < this_vmethods_size; j++)
-		{
-			method_id_item *m;
-			char *this_method_name;
-			aggregated_idx += class_data->virtual_methods[j].method_idx_diff;
-			m = get_method_item(dex, aggregated_idx);
-			this_method_name = get_string_data(dex, m->name_idx);
-			if (strcmp(parent_vtable[i].name, this_method_name) == 0)
-				overridden_size++;
-		}
-		// If the vtable entry is not overridden
-		if (overridden_size == tmp_overridden_size)
-			non_overridden_pvtable_entries[non_overridden_size++] = &parent_vtable[i];
-	} 
-	obj->vtable_size = parent_vtable_size + this_vmethods_size - overridden_size; 
+		for (j = 0; j < parent_vtable_size; j++)
+			if (same_method_sig(dex, obj->vtable[j].method_id, aggregated_idx))
+				break;
+		if (j == parent_vtable_size)
+			j = obj->vtable_size++;
+
+		obj->vtable[j].method = &class_data->virtual_methods[i];
+		obj->vtable[j].method_id = aggregated_idx;
+	}
 	if (is_verbose())
 		printf("vtable_size: %d\n", obj->vtable_size);
-	obj->vtable = malloc(sizeof(vtable_item) * obj->vtable_size);
 
-	/* Step 2: Fill the vtable with this class' virtual methods */
+	fill_vtable_map(dex, obj, class_def->class_idx);
+	printVTable(dex, obj);
+
+	if (is_verbose())
+		printf("done.\n");
+}
+
+/*
+ * Describe count encoded fields in fields and give them slots from *size
+ * on, widest first so that every slot is naturally aligned without
+ * padding between them.  *size is advanced past the last slot.  Instance
+ * fields are named after their declaring class, class_name.
+ */
+static int layout_fields(DexFileFormat *dex, field_info *fields, encoded_field *encoded, int count,
+		char *class_name, uint *size)
+{
 	int aggregated_idx = 0;
-	for (i = 0; i < this_vmethods_size; i++)
+	uint width;
+	int i;
+
+	for (i = 0; i < count; i++)
 	{
-		method_id_item *m;
+		field_id_item *field_item;
+		char *name_str;
 
-		aggregated_idx += class_data->virtual_methods[i].method_idx_diff;
-		m = get_method_item(dex, aggregated_idx);
-		strncpy(obj->vtable[i].name, get_string_data(dex, m->name_idx), sizeof(obj->vtable[i].name));
-		obj->vtable[i].method = &class_data->virtual_methods[i];
-		obj->vtable[i].method_id = aggregated_idx;
-		if (is_verbose())
-			printf("vtable[%d].name: %s\n"
-				   "vtable[%d].method_id: %d\n", 
-				   i, obj->vtable[i].name, i, obj->vtable[i].method_id);
+		aggregated_idx += encoded[i].field_idx_diff;
+		field_item = get_field_item(dex, aggregated_idx);
+		name_str = get_string_data(dex, field_item->name_idx);
+		fields[i].type = get_type_item_name(dex, field_item->type_idx);
+		fields[i].size = field_slot_size(fields[i].type);
+		if (!class_name)
+		{
+			fields[i].name = name_str;
+			continue;
+		}
+		fields[i].name = malloc(strlen(class_name) + strlen(name_str) + 2);
+		if (!fields[i].name)
+			return -1;
+		gen_full_field_name(fields[i].name, class_name, name_str);
 	}
 
-	/* Step 3: Fill the remaining vtable entries with non-overridden virtual methods from the parent class */
-	for (; i < obj->vtable_size; i++)
+	for (width = 8; width; width >>= 1)
 	{
-		memcpy(&obj->vtable[i], non_overridden_pvtable_entries[i - this_vmethods_size], sizeof(vtable_item));
-		if (is_verbose())
-			printf("vtable[%d].name: %s\n"
-				   "vtable[%d].method_id: %d\n", 
-				   i, obj->vtable[i].name, i, obj->vtable[i].method_id);
+		*size = (*size + width - 1) & ~(width - 1);
+		for (i = 0; i < count; i++)
+		{
+			if (fields[i].size != width)
+				continue;
+			fields[i].offset = *size;
+			*size += width;
+		}
 	}
+	return 0;
+}
 
-	if (non_overridden_pvtable_entries)
-		free(non_overridden_pvtable_entries);
+/*
+ * Lay out the static fields of a class and the fields of its instances,
+ * which start with those inherited from the parent class object.
+ */
+static int init_class_fields(DexFileFormat *dex, class_obj *obj, class_data_item *class_data)
+{
+	class_obj *parent = obj->parent;
+	int inherited = parent ? parent->ifield_size : 0;
+	uint statics_size = 0;
 
-	if (is_verbose())
-		printf("done.\n");
+	obj->field_size = class_data->static_fields_size;
+	obj->fields = calloc(obj->field_size + 1, sizeof(field_info));
+	obj->ifield_size = inherited + class_data->instance_fields_size;
+	obj->ifields = calloc(obj->ifield_size + 1, sizeof(field_info));
+	if (!obj->fields || !obj->ifields)
+		return -1;
+
+	if (layout_fields(dex, obj->fields, class_data->static_fields, obj->field_size,
+			NULL, &statics_size))
+		return -1;
+	obj->statics = calloc(statics_size + 1, 1);
+	if (!obj->statics)
+		return -1;
+
+	if (inherited)
+		memcpy(obj->ifields, parent->ifields, inherited * sizeof(field_info));
+	obj->instance_size = parent ? parent->instance_size : 0;
+	return layout_fields(dex, obj->ifields + inherited, class_data->instance_fields,
+			class_data->instance_fields_size, obj->name, &obj->instance_size);
 }
 
 class_obj *create_class_obj(simple_dalvik_vm *vm, DexFileFormat *dex, class_def_item *class_def, class_data_item *class_data)
 {
-	int i;
-	int aggregated_idx = 0;
 	class_obj *obj;
 	char *name;
 	class_obj *parent;
@@ -645,7 +704,7 @@ class_obj *create_class_obj(simple_dalvik_vm *vm, DexFileFormat *dex, class_def_
 	method_id_item *method;
 
 	name = get_type_item_name(dex, class_def->class_idx);
-	obj = find_class_obj(vm, name);
+	obj = find_class_obj_by_type(vm, dex, class_def->class_idx);
 	if (obj)
 		return obj;
 
@@ -669,42 +728,31 @@ class_obj *create_class_obj(simple_dalvik_vm *vm, DexFileFormat *dex, class_def_
 		parent = NULL;
 	}
 
-	obj = (class_obj*)malloc(sizeof(class_obj) + class_data->static_fields_size * sizeof(obj_field));
+	obj = (class_obj*)malloc(sizeof(class_obj));
 	if (!obj)
 	{
 		printf("alloc class obj fail\n");
 		return NULL;
 	}
 
-	memset(obj, 0, sizeof(class_obj) + class_data->static_fields_size * sizeof(obj_field));
+	memset(obj, 0, sizeof(class_obj));
 	obj->parent = parent;
-	obj->fields = (obj_field *)((char *)obj + sizeof(class_obj));
-	obj->field_size = class_data->static_fields_size;
 	strcpy(obj->name, name);
-	fill_vtable(dex, obj, class_data);
-
-	for (i = 0; i < class_data->static_fields_size; i++)
+	if (init_class_fields(dex, obj, class_data))
 	{
-		encoded_field *field = &class_data->static_fields[i];
-		obj_field *obj_field = &obj->fields[i];
-		field_id_item *field_item;
-		char *type_str, *name_str;
-
-		aggregated_idx += field->field_idx_diff;
-		field_item = get_field_item(dex, aggregated_idx);
-		name_str = get_string_data(dex, field_item->name_idx);
-		type_str = get_type_item_name(dex, field_item->type_idx);
-
-		strcpy(obj_field->name, name_str);
-		strcpy(obj_field->type, type_str);
+		printf("alloc fields of class %s fail\n", name);
+		return NULL;
 	}
+	fill_vtable(dex, obj, class_def, class_data);
 	// TODO: wrap it to another class_*-series function?
-	hash_add(&vm->root_set, &obj->class_list, hash(obj->name));
+	hash_put(&vm->root_set, hash(obj->name), obj->name, obj);
+	cache_class_obj(vm, class_def->class_idx, obj);
 
 	// If there is a <clinit>, call it to initialize static fields 
+	// before the instruction that needs the class goes on
 	method = get_method_item_by_name(dex, class_def->class_idx, "<clinit>");
-	if (method)
-		invoke_method("invoke-direct", dex, vm, method, &vm->p);
+	if (method && invoke_method("invoke-direct", dex, vm, method, &vm->p))
+		runMethod(dex, vm);
 
 	if (is_verbose())
 		printf("Class object for %s is created: 0x%08x\n", obj->name, obj);
@@ -712,77 +760,20 @@ class_obj *create_class_obj(simple_dalvik_vm *vm, DexFileFormat *dex, class_def_
 	return obj;
 }
 
-instance_obj *create_instance_obj(DexFileFormat *dex, class_obj *cls, class_def_item *class_def, class_data_item *class_data)
+/* An instance of cls with all its field slots zeroed */
+instance_obj *create_instance_obj(simple_dalvik_vm *vm, class_obj *cls)
 {
-	int i, j, k = 0;
-	int idx_cls_data = 0;
-	int aggregated_idx = 0;
 	instance_obj *obj;
-	uint fields_size = 0;
-	class_def_item *parent_class_def;
-	class_data_item *parent_class_data;
-	int parent_type_id;
-	char *parent_name;
-	class_data_item *total_class_data[256];
-	char *total_class_name[256];
-	class_data_item *cls_data_ptr;
-
-	parent_type_id = class_def->superclass_idx;
-	parent_name = get_type_item_name(dex, parent_type_id);
-	parent_class_def = find_class_def(dex, parent_type_id);
-	parent_class_data = find_class_data(dex, parent_type_id);
-
-	fields_size = class_data->instance_fields_size;
-	total_class_data[idx_cls_data] = class_data;
-	total_class_name[idx_cls_data] = get_type_item_name(dex, class_def->class_idx);
-
-	while (strcmp(parent_name, "Ljava/lang/Object;"))
-	{
-		idx_cls_data++;
-		fields_size += parent_class_data->instance_fields_size;
-		total_class_data[idx_cls_data] = parent_class_data;
-		total_class_name[idx_cls_data] = parent_name;
-
-		parent_type_id = parent_class_def->superclass_idx;
-		parent_name = get_type_item_name(dex, parent_type_id);
-		parent_class_def = find_class_def(dex, parent_type_id);
-		parent_class_data = find_class_data(dex, parent_type_id);
-	}
 
-	obj = (instance_obj*)malloc(sizeof(instance_obj) + fields_size * sizeof(obj_field));
+	obj = (instance_obj*)heap_alloc(&vm->heap, sizeof(instance_obj) + cls->instance_size,
+			OBJ_INSTANCE, cls->name);
 	if (!obj)
 	{
 		printf("alloc instance obj fail\n");
 		return NULL;
 	}
 
-	memset(obj, 0, sizeof(instance_obj) + fields_size * sizeof(obj_field));
-	obj->fields = (obj_field *)((char *)obj + sizeof(instance_obj));
 	obj->cls = cls;
-	obj->field_size = fields_size;
-
-	for (j = 0; j <= idx_cls_data; j++)
-	{
-		cls_data_ptr = total_class_data[j];
-		aggregated_idx = 0;
-		for (i = 0; i < cls_data_ptr->instance_fields_size; i++)
-		{
-			encoded_field *field = &cls_data_ptr->instance_fields[i];
-			obj_field *obj_field = &obj->fields[k++];
-			field_id_item *field_item;
-			char *type_str, *name_str;
-
-			aggregated_idx += field->field_idx_diff;
-			field_item = get_field_item(dex, aggregated_idx);
-			name_str = get_string_data(dex, field_item->name_idx);
-			type_str = get_type_item_name(dex, field_item->type_idx);
-
-			strcpy(obj_field->name, total_class_name[j]);
-			strcat(obj_field->name, "."); 
-			strcat(obj_field->name, name_str); 
-			strcpy(obj_field->type, type_str);
-		}
-	}
 
 	return obj;
 }
@@ -793,7 +784,7 @@ instance_obj *new_instance_java_lang_library(simple_dalvik_vm *vm, DexFileFormat
 	instance_obj *ins_obj;
 	char *name = get_type_item_name(dex, type_id);
 
-	cls_obj = find_class_obj(vm, name);
+	cls_obj = find_class_obj_by_type(vm, dex, type_id);
 	if (!cls_obj)
 	{
 		cls_obj = (class_obj *)malloc(sizeof(class_obj));
@@ -805,11 +796,11 @@ instance_obj *new_instance_java_lang_library(simple_dalvik_vm *vm, DexFileFormat
 
 		memset(cls_obj, 0, sizeof(class_obj));
 		strncpy(cls_obj->name, name, strlen(name));
-		list_init(&cls_obj->class_list);
-		hash_add(&vm->root_set, &cls_obj->class_list, hash(cls_obj->name));
+		hash_put(&vm->root_set, hash(cls_obj->name), cls_obj->name, cls_obj);
+		cache_class_obj(vm, type_id, cls_obj);
 	}
 
-	ins_obj = (instance_obj *)malloc(sizeof(instance_obj));
+	ins_obj = (instance_obj *)heap_alloc(&vm->heap, sizeof(instance_obj), OBJ_INSTANCE, cls_obj->name);
 	if (!ins_obj)
 	{
 		printf("[%s] class obj malloc fail\n", __FUNCTION__);
@@ -817,7 +808,6 @@ instance_obj *new_instance_java_lang_library(simple_dalvik_vm *vm, DexFileFormat
 		return NULL;
 	}
 
-	memset(ins_obj, 0, sizeof(instance_obj));
 	ins_obj->cls = cls_obj;
 
 	return ins_obj;
@@ -829,9 +819,8 @@ static instance_obj *new_array(simple_dalvik_vm *vm, DexFileFormat *dex, int typ
 	instance_obj *ins_obj;
 	array_obj *arr_obj;
 	char *name = get_type_item_name(dex, type_id);
-	int arr_obj_size;
 
-	cls_obj = find_class_obj(vm, name);
+	cls_obj = find_class_obj_by_type(vm, dex, type_id);
         if (!cls_obj)
 	{
 		cls_obj = (class_obj *)malloc(sizeof(class_obj));
@@ -843,11 +832,11 @@ static instance_obj *new_array(simple_dalvik_vm *vm, DexFileFormat *dex, int typ
 
 		memset(cls_obj, 0, sizeof(class_obj));
 		strncpy(cls_obj->name, name, strlen(name));
-		list_init(&cls_obj->class_list);
-		hash_add(&vm->root_set, &cls_obj->class_list, hash(cls_obj->name));
+		hash_put(&vm->root_set, hash(cls_obj->name), cls_obj->name, cls_obj);
+		cache_class_obj(vm, type_id, cls_obj);
 	}
 
-	ins_obj = (instance_obj *)malloc(sizeof(instance_obj));
+	ins_obj = (instance_obj *)heap_alloc(&vm->heap, sizeof(instance_obj), OBJ_INSTANCE, cls_obj->name);
 	if (!ins_obj)
 	{
 		printf("[%s] instance obj malloc fail\n", __FUNCTION__);
@@ -855,25 +844,13 @@ static instance_obj *new_array(simple_dalvik_vm *vm, DexFileFormat *dex, int typ
 		return NULL;
 	}
 
-	/* If it's an array of double number, the size should be doubled */
-	if (strcmp(name, "[D") == 0)
-		size <<= 1;
-	arr_obj_size = sizeof(array_obj) + (size - 1) * sizeof(void *);
-
-	arr_obj = (array_obj *)malloc(arr_obj_size);
+	arr_obj = alloc_array(vm, cls_obj->name, size);
 	if (!arr_obj)
-	{
-		printf("[%s] array obj malloc fail\n", __FUNCTION__);
-		free(ins_obj);
-
 		return NULL;
-	}
 
-	memset(ins_obj, 0, sizeof(instance_obj));
-	memset(arr_obj, 0, arr_obj_size);
-	arr_obj->size = size;
 	ins_obj->cls = cls_obj;
 	ins_obj->priv_data = (void *)arr_obj;
+	heap_write_barrier(&vm->heap, ins_obj, arr_obj);
 
 	return ins_obj;
 }
@@ -909,7 +886,7 @@ static int op_new_array(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *
         printf("\n");
     }
 
-    load_reg_to(vm, reg_idx_vb, (unsigned char *)&size);
+    size = get_reg_int(vm, reg_idx_vb);
     ins_obj = new_array(vm, dex, type_id, size);
     if (!ins_obj)
        return -1;
@@ -936,13 +913,18 @@ static instance_obj *util_op_filled_new_array(DexFileFormat *dex, simple_dalvik_
 	}
 	arr_obj = (array_obj *)ins_obj->priv_data;
 
-	arr_obj->size = size;
+	/* only int and reference arrays can be filled this way */
 	for (i = 0; i < size; i++)
 	{
-		unsigned int tmp;
-
-		load_reg_to(vm, p->reg_idx[i], (unsigned char *)&tmp);
-		arr_obj->ptr[i] = (void *)tmp;
+		if (array_holds_refs(arr_obj))
+		{
+			load_reg_to(vm, p->reg_idx[i], (unsigned char *)&array_refs(arr_obj)[i]);
+			heap_write_barrier(&vm->heap, arr_obj, array_refs(arr_obj)[i]);
+		}
+		else
+		{
+			((int *)arr_obj->data)[i] = get_reg_int(vm, p->reg_idx[i]);
+		}
 	}
 
 	return ins_obj;
@@ -1026,6 +1008,69 @@ static int op_filled_new_array(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr
     return 0;
 }
 
+/* 0x26 fill-array-data va, offset
+ * Fills the array referenced in va with the fill-array-data payload at
+ * offset code units from this instruction
+ * 2600 0600 0000 - fill-array-data v0, +0006
+ */
+static int op_fill_array_data(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
+{
+    int reg_idx_va = ptr[*pc + 1];
+    int offset = ptr[*pc + 5] << 24 | ptr[*pc + 4] << 16 | ptr[*pc + 3] << 8 | ptr[*pc + 2];
+    u1 *payload = ptr + *pc + offset * 2;
+    uint width = payload[3] << 8 | payload[2];
+    uint count = payload[7] << 24 | payload[6] << 16 | payload[5] << 8 | payload[4];
+    instance_obj *arr_ins_obj;
+    array_obj *arr_obj;
+
+    if (is_verbose())
+        printf("fill-array-data v%d, %+d\n", reg_idx_va, offset);
+
+    load_reg_to(vm, reg_idx_va, (unsigned char *)&arr_ins_obj);
+    if (!arr_ins_obj)
+    {
+        printf("[%s] fill-array-data of a null array\n", __FUNCTION__);
+        return -1;
+    }
+
+    arr_obj = (array_obj *)arr_ins_obj->priv_data;
+    if (width != arr_obj->width || count > (uint)arr_obj->size)
+    {
+        printf("[%s] %u %u-byte elements do not fit array %s: size: %d\n", __FUNCTION__,
+                count, width, arr_ins_obj->cls->name, arr_obj->size);
+        return -1;
+    }
+    memcpy(arr_obj->data, payload + 8, count * width);
+
+    *pc = *pc + 6;
+    return 0;
+}
+
+/* 0x21 array-length va, vb
+ * Puts the length of the array referenced in vb into va
+ * 2112 - array-length v2, v1
+ */
+static int op_array_length(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
+{
+    int reg_idx_va = ptr[*pc + 1] & 0x0F;
+    int reg_idx_vb = (ptr[*pc + 1] >> 4) & 0x0F;
+    instance_obj *arr_ins_obj;
+
+    if (is_verbose())
+        printf("array-length v%d, v%d\n", reg_idx_va, reg_idx_vb);
+
+    load_reg_to(vm, reg_idx_vb, (unsigned char *)&arr_ins_obj);
+    if (!arr_ins_obj)
+    {
+        printf("[%s] array-length of a null array\n", __FUNCTION__);
+        return -1;
+    }
+    set_reg_int(vm, reg_idx_va, ((array_obj *)arr_ins_obj->priv_data)->size);
+
+    *pc = *pc + 2;
+    return 0;
+}
+
 /* 0x22 new-instance vx,type
  * Instantiates an object type and puts
  * the reference of the newly created instance into vx
@@ -1087,7 +1132,7 @@ static int op_new_instance(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
         return -1;
     }
 
-    ins_obj = create_instance_obj(dex, cls_obj, class_def, class_data);
+    ins_obj = create_instance_obj(vm, cls_obj);
 	printInsFields(ins_obj);
     if (!ins_obj)
     {
@@ -1189,7 +1234,7 @@ static int op_packed_switch(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
     if (is_verbose())
         printf("packed-switch v%d, +0x%08x\n", reg_idx_vx, offset);
 
-	load_reg_to(vm, reg_idx_vx, (unsigned char *)&value);
+	value = get_reg_int(vm, reg_idx_vx);
 	ident = (ushort) ((ptr[*pc + offset_word + 1] << 8) | ptr[*pc + offset_word]);
 	size = (ushort) ((ptr[*pc + offset_word + 3] << 8) | ptr[*pc + offset_word + 2]);
 	first_key = (int) ((ptr[*pc + offset_word + 7] << 24) | (ptr[*pc + offset_word + 6] << 16) |
@@ -1235,7 +1280,7 @@ static int op_cmp_long(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *p
 		value = 1;
 	else if (cmp_reg_long(vm, reg_idx_vy, reg_idx_vz, LT) == 0)
 		value = -1;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &value);
+    set_reg_int(vm, reg_idx_vx, value);
 
 	*pc = *pc + 4;
     return 0;
@@ -1559,24 +1604,19 @@ static int invoke_method(char *name, DexFileFormat *dex, simple_dalvik_vm *vm,
 		method_id_item *m, invoke_parameters *p)
 {
 	encoded_method *method;
-	int ins_size;
-	int reg_size;
-	int target_idx, i;
-	u4 values[32];
-	u4 tmp;
 
 	if (!strcmp(name, "invoke-virtual"))
 	{
 		instance_obj *ins_obj;
 
 		load_reg_to(vm, p->reg_idx[0], (unsigned char *)&ins_obj);
-		method = find_vmethod(dex, ins_obj, (int)m->class_idx, (int)m->name_idx);
+		method = find_vmethod(dex, ins_obj, p->method_id);
 	}
 //	else if (strcmp(name, "invoke-static"))
 		// FIXME
 	else
 	{
-		method = find_method(dex, (int)m->class_idx, (int)m->name_idx);
+		method = find_method(dex, m - dex->method_id_item);
 	}
 
 	if (!method)
@@ -1592,51 +1632,26 @@ static int invoke_method(char *name, DexFileFormat *dex, simple_dalvik_vm *vm,
 		return 0;
 	}
 
+	return invoke_encoded_method(dex, vm, method, p);
+}
+
+/*
+ * Push a new frame for the resolved method and pass the arguments listed in
+ * p; the interpreter loop continues in the callee.  vm->pc must already
+ * hold the caller's return pc.
+ */
+static int invoke_encoded_method(DexFileFormat *dex, simple_dalvik_vm *vm,
+		encoded_method *method, invoke_parameters *p)
+{
 	if (is_verbose())
 		printRegs(vm);
 
-	if (new_invoke_frame(dex, vm, method))
-	{
-		printf("new frame fail\n");
+	if (new_invoke_frame(dex, vm, method, p))
 		return 0;
-	}
-
-	ins_size = method->code_item.ins_size;
-	reg_size = method->code_item.registers_size;
-	target_idx = reg_size - 1;
-
-	/*
-	 * Load register contents to internal storage
-	 */
-	for (i = ins_size - 1; i >= 0; i--, target_idx--)
-	{
-		if (is_verbose())
-			printf("reg %d --> %d\n", p->reg_idx[i], target_idx);
-		load_reg_to(vm, p->reg_idx[i], (u1 *)&values[target_idx]);
-	}
-
-	/*
-	 * Store contents to destination registers
-	 */
-	target_idx = reg_size - 1;
-	for (i = ins_size - 1; i >= 0; i--, target_idx--)
-		store_to_reg(vm, target_idx, (u1 *)&values[target_idx]);
-
-	/*
-	 * Initialize other registers with 0
-	 */
-	tmp = 0;
-	for (i = target_idx; i >= 0; i--)
-	{
-		store_to_reg(vm, i, (u1 *)&tmp);
-	}
 
 	if (is_verbose())
 		printRegs(vm);
 
-	vm->pc = 0;
-	runMethod(dex, vm, method);
-
 	return 1;
 }
 
@@ -1752,9 +1767,9 @@ static int op_invoke_virtual(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr,
     int string_id = 0;
 
     op_utils_invoke_35c_parse(dex, ptr, pc, &vm->p);
-    op_utils_invoke("invoke-virtual", dex, vm, &vm->p);
-    /* TODO */
+    /* the callee frame returns to the next instruction */
     *pc = *pc + 6;
+    op_utils_invoke("invoke-virtual", dex, vm, &vm->p);
     return 0;
 }
 
@@ -1767,9 +1782,9 @@ static int op_invoke_direct(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
     int string_id = 0;
 
     op_utils_invoke_35c_parse(dex, ptr, pc, &vm->p);
-    op_utils_invoke("invoke-direct", dex, vm, &vm->p);
-    /* TODO */
+    /* the callee frame returns to the next instruction */
     *pc = *pc + 6;
+    op_utils_invoke("invoke-direct", dex, vm, &vm->p);
     return 0;
 }
 
@@ -1782,216 +1797,89 @@ static int op_invoke_static(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
     int string_id = 0;
 
     op_utils_invoke_35c_parse(dex, ptr, pc, &vm->p);
-    op_utils_invoke("invoke-static", dex, vm, &vm->p);
-    /* TODO */
+    /* the callee frame returns to the next instruction */
     *pc = *pc + 6;
+    op_utils_invoke("invoke-static", dex, vm, &vm->p);
     return 0;
 }
 
 /*
- * 23x family aget operation for 4-byte long data
+ * 23x family array access: decode "op va, vb, vc" and return the address
+ * of element vc of the array in vb, which must be "width" bytes wide
  */
-static int op_utils_aget(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc, char *op_name)
+static u1 *op_utils_array_element(simple_dalvik_vm *vm, u1 *ptr, int *pc, char *op_name,
+		int width, array_obj **arr)
 {
-	int reg_idx_va = 0;
-	int reg_idx_vb = 0;
-	int reg_idx_vc = 0;
-	int size;
-	int idx;
+	int reg_idx_va = ptr[*pc + 1];
+	int reg_idx_vb = ptr[*pc + 2];
+	int reg_idx_vc = ptr[*pc + 3];
 	instance_obj *arr_ins_obj;
 	array_obj *arr_obj;
-	unsigned int data;
-
-	reg_idx_va = ptr[*pc + 1];
-	reg_idx_vb = ptr[*pc + 2];
-	reg_idx_vc = ptr[*pc + 3];
+	int idx;
 
-	if (is_verbose()) {
-		printf("%s v%d, v%d, v%d", op_name, reg_idx_va, reg_idx_vb, reg_idx_vc);
-		printf("\n");
-	}
+	if (is_verbose())
+		printf("%s v%d, v%d, v%d\n", op_name, reg_idx_va, reg_idx_vb, reg_idx_vc);
 
 	load_reg_to(vm, reg_idx_vb, (unsigned char *)&arr_ins_obj);
-	load_reg_to(vm, reg_idx_vc, (unsigned char *)&idx);
+	idx = get_reg_int(vm, reg_idx_vc);
+	if (!arr_ins_obj)
+	{
+		printf("[%s] %s on a null array\n", __FUNCTION__, op_name);
+		return NULL;
+	}
 
 	arr_obj = (array_obj *)arr_ins_obj->priv_data;
-	if (idx >= arr_obj->size)
+	if ((unsigned int)idx >= (unsigned int)arr_obj->size)
 	{
 		printf("[%s] Out of boundary in array %s: size: %d, idx: %d\n", __FUNCTION__,
 			arr_ins_obj->cls->name, arr_obj->size, idx);
-		return -1;
+		return NULL;
+	}
+	if (arr_obj->width != width)
+	{
+		printf("[%s] %s on array %s of %d-byte elements\n", __FUNCTION__, op_name,
+			arr_ins_obj->cls->name, arr_obj->width);
+		return NULL;
 	}
 
-	data = (unsigned int)arr_obj->ptr[idx];
-
-	store_to_reg(vm, reg_idx_va, (unsigned char *)&data);
+	*arr = arr_obj;
+	return arr_obj->data + idx * width;
+}
 
-	if (is_verbose())
-		printRegs(vm);
+/* 0x44 aget va, vb, vc
+ * Load data from the element of an array pointed by vb,
+ * which is indexed by vc, to va
+ * 4402 0100 - aput v2, v1, v0
+ */
+static int op_aget(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
+{
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aget", 4, &arr_obj);
 
+	if (!elem)
+		return -1;
+	set_reg_int(vm, ptr[*pc + 1], *(int *)elem);
 	*pc = *pc + 4;
 	return 0;
 }
 
-/*
- * 23x family aget operation for 8-byte long data
+/* 0x45 aget-wide va, vb, vc
+ * Load data from the element of an array pointed by vb,
+ * which is indexed by vc, to va,va + 1
+ * 4502 0100 - aput v2, v1, v0
  */
-static int op_utils_aget_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc, char *op_name)
+static int op_aget_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	int reg_idx_va = 0;
-	int reg_idx_vb = 0;
-	int reg_idx_vc = 0;
-	int size;
-	int idx;
-	instance_obj *arr_ins_obj;
 	array_obj *arr_obj;
-	unsigned int data[2];
-
-	reg_idx_va = ptr[*pc + 1];
-	reg_idx_vb = ptr[*pc + 2];
-	reg_idx_vc = ptr[*pc + 3];
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aget-wide", 8, &arr_obj);
 
-	if (is_verbose()) {
-		printf("%s v%d, v%d, v%d", op_name, reg_idx_va, reg_idx_vb, reg_idx_vc);
-		printf("\n");
-	}
-
-	load_reg_to(vm, reg_idx_vb, (unsigned char *)&arr_ins_obj);
-	load_reg_to(vm, reg_idx_vc, (unsigned char *)&idx);
-
-	arr_obj = (array_obj *)arr_ins_obj->priv_data;
-	idx *= 2;
-	if (idx >= arr_obj->size)
-	{
-		printf("[%s] Out of boundary in array %s: size: %d, idx: %d\n", __FUNCTION__,
-			arr_ins_obj->cls->name, arr_obj->size, idx);
-		return -1;
-	}
-
-	data[0] = (unsigned int)arr_obj->ptr[idx];
-	data[1] = (unsigned int)arr_obj->ptr[idx + 1];
-
-	store_double_to_reg(vm, reg_idx_va, (unsigned char *)&data[1]);
-	store_double_to_reg(vm, reg_idx_va + 1, (unsigned char *)&data[0]);
-
-	if (is_verbose())
-		printRegs(vm);
-
-	*pc = *pc + 4;
-	return 0;
-}
-
-/*
- * 23x family aput operation for 4-byte long data
- */
-static int op_utils_aput(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc, char *op_name)
-{
-	int reg_idx_va = 0;
-	int reg_idx_vb = 0;
-	int reg_idx_vc = 0;
-	int size;
-	int idx;
-	instance_obj *arr_ins_obj;
-	array_obj *arr_obj;
-	unsigned int data;
-
-	reg_idx_va = ptr[*pc + 1];
-	reg_idx_vb = ptr[*pc + 2];
-	reg_idx_vc = ptr[*pc + 3];
-
-	if (is_verbose()) {
-		printf("%s v%d, v%d, v%d", op_name, reg_idx_va, reg_idx_vb, reg_idx_vc);
-		printf("\n");
-	}
-
-	load_reg_to(vm, reg_idx_va, (unsigned char *)&data);
-	load_reg_to(vm, reg_idx_vb, (unsigned char *)&arr_ins_obj);
-	load_reg_to(vm, reg_idx_vc, (unsigned char *)&idx);
-
-	arr_obj = (array_obj *)arr_ins_obj->priv_data;
-	if (idx >= arr_obj->size)
-	{
-		printf("[%s] Out of boundary in array %s: size: %d, idx: %d\n", __FUNCTION__,
-			arr_ins_obj->cls->name, arr_obj->size, idx);
-		return -1;
-	}
-
-	arr_obj->ptr[idx] = (void *)data;
-
-	if (is_verbose())
-		dump_array(arr_ins_obj);
-
-	*pc = *pc + 4;
-	return 0;
-}
-
-/*
- * 23x family aput operation for 8-byte long data
- */
-static int op_utils_aput_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc, char *op_name)
-{
-	int reg_idx_va = 0;
-	int reg_idx_vb = 0;
-	int reg_idx_vc = 0;
-	int size;
-	int idx;
-	instance_obj *arr_ins_obj;
-	array_obj *arr_obj;
-	unsigned int data[2];
-
-	reg_idx_va = ptr[*pc + 1];
-	reg_idx_vb = ptr[*pc + 2];
-	reg_idx_vc = ptr[*pc + 3];
-
-	if (is_verbose()) {
-		printf("%s v%d, v%d, v%d", op_name, reg_idx_va, reg_idx_vb, reg_idx_vc);
-		printf("\n");
-	}
-
-	load_reg_to_double(vm, reg_idx_va, (unsigned char *)&data[1]);
-	load_reg_to_double(vm, reg_idx_va + 1, (unsigned char *)&data[0]);
-	load_reg_to(vm, reg_idx_vb, (unsigned char *)&arr_ins_obj);
-	load_reg_to(vm, reg_idx_vc, (unsigned char *)&idx);
-
-	arr_obj = (array_obj *)arr_ins_obj->priv_data;
-	idx *= 2;
-	if (idx >= arr_obj->size)
-	{
-		printf("[%s] Out of boundary in array %s: size: %d, idx: %d\n", __FUNCTION__,
-			arr_ins_obj->cls->name, arr_obj->size, idx);
+	if (!elem)
 		return -1;
-	}
-
-	arr_obj->ptr[idx] = (void *)data[0];
-	arr_obj->ptr[idx + 1] = (void *)data[1];
-
-	if (is_verbose())
-		dump_array_wide(arr_ins_obj);
-
+	store_wide_to_reg(vm, ptr[*pc + 1], elem);
 	*pc = *pc + 4;
 	return 0;
 }
 
-/* 0x44 aget va, vb, vc
- * Load data from the element of an array pointed by vb,
- * which is indexed by vc, to va
- * 4402 0100 - aput v2, v1, v0
- */
-static int op_aget(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
-{
-	return op_utils_aget(dex, vm, ptr, pc, "aget");
-}
-
-/* 0x45 aget-wide va, vb, vc
- * Load data from the element of an array pointed by vb,
- * which is indexed by vc, to va,va + 1
- * 4502 0100 - aput v2, v1, v0
- */
-static int op_aget_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
-{
-	return op_utils_aget_wide(dex, vm, ptr, pc, "aget-wide");
-}
-
 /* 0x46 aget-object va, vb, vc
  * Load data from the element of an array pointed by vb,
  * which is indexed by vc, to va
@@ -1999,7 +1887,14 @@ static int op_aget_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *
  */
 static int op_aget_object(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aget(dex, vm, ptr, pc, "aget-object");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aget-object", sizeof(void *), &arr_obj);
+
+	if (!elem)
+		return -1;
+	store_to_reg(vm, ptr[*pc + 1], elem);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x47 aget-boolean va, vb, vc
@@ -2009,7 +1904,14 @@ static int op_aget_object(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
  */
 static int op_aget_boolean(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aget(dex, vm, ptr, pc, "aget-boolean");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aget-boolean", 1, &arr_obj);
+
+	if (!elem)
+		return -1;
+	set_reg_int(vm, ptr[*pc + 1], *elem);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x48 aget-byte va, vb, vc
@@ -2019,7 +1921,14 @@ static int op_aget_boolean(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
  */
 static int op_aget_byte(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aget(dex, vm, ptr, pc, "aget-byte");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aget-byte", 1, &arr_obj);
+
+	if (!elem)
+		return -1;
+	set_reg_int(vm, ptr[*pc + 1], *(signed char *)elem);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x49 aget-char va, vb, vc
@@ -2029,7 +1938,14 @@ static int op_aget_byte(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *
  */
 static int op_aget_char(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aget(dex, vm, ptr, pc, "aget-char");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aget-char", 2, &arr_obj);
+
+	if (!elem)
+		return -1;
+	set_reg_int(vm, ptr[*pc + 1], *(unsigned short *)elem);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x4a aget-short va, vb, vc
@@ -2039,7 +1955,14 @@ static int op_aget_char(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *
  */
 static int op_aget_short(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aget(dex, vm, ptr, pc, "aget-short");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aget-short", 2, &arr_obj);
+
+	if (!elem)
+		return -1;
+	set_reg_int(vm, ptr[*pc + 1], *(short *)elem);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x4b aput va, vb, vc
@@ -2049,7 +1972,14 @@ static int op_aget_short(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
  */
 static int op_aput(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aput(dex, vm, ptr, pc, "aput");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aput", 4, &arr_obj);
+
+	if (!elem)
+		return -1;
+	*(int *)elem = get_reg_int(vm, ptr[*pc + 1]);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x4c aput-wide va, vb, vc
@@ -2059,7 +1989,14 @@ static int op_aput(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
  */
 static int op_aput_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aput_wide(dex, vm, ptr, pc, "aput-wide");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aput-wide", 8, &arr_obj);
+
+	if (!elem)
+		return -1;
+	load_reg_to_wide(vm, ptr[*pc + 1], elem);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x4d aput-object va, vb, vc
@@ -2069,7 +2006,15 @@ static int op_aput_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *
  */
 static int op_aput_object(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aput(dex, vm, ptr, pc, "aput-object");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aput-object", sizeof(void *), &arr_obj);
+
+	if (!elem)
+		return -1;
+	load_reg_to(vm, ptr[*pc + 1], elem);
+	heap_write_barrier(&vm->heap, arr_obj, *(void **)elem);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x4e aput-boolean va, vb, vc
@@ -2079,7 +2024,14 @@ static int op_aput_object(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
  */
 static int op_aput_boolean(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aput(dex, vm, ptr, pc, "aput-boolean");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aput-boolean", 1, &arr_obj);
+
+	if (!elem)
+		return -1;
+	*elem = get_reg_int(vm, ptr[*pc + 1]);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x4f aput-byte va, vb, vc
@@ -2089,7 +2041,14 @@ static int op_aput_boolean(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
  */
 static int op_aput_byte(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aput(dex, vm, ptr, pc, "aput-byte");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aput-byte", 1, &arr_obj);
+
+	if (!elem)
+		return -1;
+	*elem = get_reg_int(vm, ptr[*pc + 1]);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x50 aput-char va, vb, vc
@@ -2099,7 +2058,14 @@ static int op_aput_byte(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *
  */
 static int op_aput_char(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aput(dex, vm, ptr, pc, "aput-char");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aput-char", 2, &arr_obj);
+
+	if (!elem)
+		return -1;
+	*(unsigned short *)elem = get_reg_int(vm, ptr[*pc + 1]);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /* 0x51 aput-short va, vb, vc
@@ -2109,7 +2075,14 @@ static int op_aput_char(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *
  */
 static int op_aput_short(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
-	return op_utils_aput(dex, vm, ptr, pc, "aput-short");
+	array_obj *arr_obj;
+	u1 *elem = op_utils_array_element(vm, ptr, pc, "aput-short", 2, &arr_obj);
+
+	if (!elem)
+		return -1;
+	*(short *)elem = get_reg_int(vm, ptr[*pc + 1]);
+	*pc = *pc + 4;
+	return 0;
 }
 
 /*
@@ -2122,7 +2095,6 @@ static int op_utils_iget(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
     int reg_idx_vb = 0;
 	char full_field_name[255];
     int i;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1] & 0xf;
     reg_idx_vb = (ptr[*pc + 1] >> 4) & 0xf;
@@ -2149,7 +2121,6 @@ static int op_utils_iget_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr,
     int reg_idx_vb = 0;
     char full_field_name[256];
     int i;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1] & 0xf;
     reg_idx_vb = (ptr[*pc + 1] >> 4) & 0xf;
@@ -2273,7 +2244,6 @@ static int op_utils_sget(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
     int reg_idx_va = 0;
     int i;
     char *class_name, *field_name;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1];
     field_id = ((ptr[*pc + 3] << 8) | ptr[*pc + 2]);
@@ -2309,7 +2279,6 @@ static int op_utils_sget_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr,
     int reg_idx_va = 0;
     int i;
     char *class_name, *field_name;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1];
     field_id = ((ptr[*pc + 3] << 8) | ptr[*pc + 2]);
@@ -2354,7 +2323,6 @@ static int op_utils_sput(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
     int reg_idx_va = 0;
     int i;
     char *class_name, *field_name;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1];
     field_id = ((ptr[*pc + 3] << 8) | ptr[*pc + 2]);
@@ -2399,7 +2367,6 @@ static int op_utils_sput_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr,
     int reg_idx_va = 0;
     int i;
     char *class_name, *field_name;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1];
     field_id = ((ptr[*pc + 3] << 8) | ptr[*pc + 2]);
@@ -2445,7 +2412,6 @@ static int op_utils_iput(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
     int reg_idx_vb = 0;
 	char full_field_name[255];
     int i;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1] & 0xf;
     reg_idx_vb = (ptr[*pc + 1] >> 4) & 0xf;
@@ -2476,7 +2442,6 @@ static int op_utils_iput_wide(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr,
     int reg_idx_vb = 0;
     char full_field_name[256];
     int i;
-    obj_field *found = NULL;
 
     reg_idx_va = ptr[*pc + 1] & 0xf;
     reg_idx_vb = (ptr[*pc + 1] >> 4) & 0xf;
@@ -2528,7 +2493,13 @@ out:
  */
 static int op_iput_object(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
+	instance_obj *obj;
+	void *value;
+
+	load_reg_to(vm, ptr[*pc + 1] & 0xf, (unsigned char *) &value);
+	load_reg_to(vm, (ptr[*pc + 1] >> 4) & 0xf, (unsigned char *) &obj);
 	op_utils_iput(dex, vm, ptr, pc);
+	heap_write_barrier(&vm->heap, obj, value);
 out:
     /* TODO */
     *pc = *pc + 4;
@@ -2726,7 +2697,11 @@ out:
  */
 static int op_sput_object(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
+	void *value;
+
+	load_reg_to(vm, ptr[*pc + 1], (unsigned char *) &value);
 	op_utils_sput(dex, vm, ptr, pc);
+	heap_static_barrier(&vm->heap, value);
 
 out:
     /* TODO */
@@ -2813,10 +2788,10 @@ static int op_add_int(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc
         printf("add-int v%d, v%d, v%d\n", reg_idx_vx, reg_idx_vy,
                reg_idx_vz);
     /* x = y + z */
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
-    load_reg_to(vm, reg_idx_vz, (unsigned char *) &z);
+    y = get_reg_int(vm, reg_idx_vy);
+    z = get_reg_int(vm, reg_idx_vz);
     x = y + z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
     *pc = *pc + 4;
     return 0;
 
@@ -2841,10 +2816,10 @@ static int op_sub_int(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc
         printf("sub-int v%d, v%d, v%d\n", reg_idx_vx, reg_idx_vz,
                reg_idx_vy);
     /* x = y + z */
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
-    load_reg_to(vm, reg_idx_vz, (unsigned char *) &z);
+    y = get_reg_int(vm, reg_idx_vy);
+    z = get_reg_int(vm, reg_idx_vz);
     x = y - z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
     *pc = *pc + 4;
     return 0;
 }
@@ -2867,10 +2842,10 @@ static int op_mul_int(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc
     if (is_verbose())
         printf("add-int v%d, v%d, v%d\n", reg_idx_vx, reg_idx_vy, reg_idx_vz);
     /* x = y + z */
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
-    load_reg_to(vm, reg_idx_vz, (unsigned char *) &z);
+    y = get_reg_int(vm, reg_idx_vy);
+    z = get_reg_int(vm, reg_idx_vz);
     x = y * z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
     *pc = *pc + 4;
     return 0;
 
@@ -2894,10 +2869,10 @@ static int op_div_int(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc
     if (is_verbose())
         printf("add-int v%d, v%d, v%d\n", reg_idx_vx, reg_idx_vy, reg_idx_vz);
 
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
-    load_reg_to(vm, reg_idx_vz, (unsigned char *) &z);
+    y = get_reg_int(vm, reg_idx_vy);
+    z = get_reg_int(vm, reg_idx_vz);
     x = y / z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
     *pc = *pc + 4;
     return 0;
 
@@ -2921,13 +2896,10 @@ static int op_div_long(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *p
     if (is_verbose())
         printf("div-long v%d, v%d, v%d\n", reg_idx_vx, reg_idx_vy, reg_idx_vz);
 
-    load_reg_to_double(vm, reg_idx_vy, (unsigned char *) &y + 4);
-    load_reg_to_double(vm, reg_idx_vy + 1, (unsigned char *) &y);
-    load_reg_to_double(vm, reg_idx_vz, (unsigned char *) &z + 4);
-    load_reg_to_double(vm, reg_idx_vz + 1, (unsigned char *) &z);
+    y = get_reg_long(vm, reg_idx_vy);
+    z = get_reg_long(vm, reg_idx_vz);
     x = y / z;
-    store_double_to_reg(vm, reg_idx_vx, (unsigned char *) &x + 4);
-    store_double_to_reg(vm, reg_idx_vx + 1, (unsigned char *) &x);
+    set_reg_long(vm, reg_idx_vx, x);
 
     *pc = *pc + 4;
     return 0;
@@ -2943,15 +2915,12 @@ static int op_int_to_long(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
 {
     int reg_idx_vx = 0;
     int reg_idx_vy = 0;
-    int reg_idx_vz = 0;
 	long long l = 0;
-    unsigned char *ptr_l = (unsigned char *) &l;
     int i = 0;
     reg_idx_vx = ptr[*pc + 1] & 0x0F;
-    reg_idx_vz = reg_idx_vx + 1;
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F;
 
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &i);
+    i = get_reg_int(vm, reg_idx_vy);
 
     l = (long long)i;
     if (is_verbose()) {
@@ -2959,8 +2928,7 @@ static int op_int_to_long(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
         printf("(%d) to (%ld) \n", i , l);
     }
 
-    store_double_to_reg(vm, reg_idx_vx , ptr_l + 4);
-    store_double_to_reg(vm, reg_idx_vz , ptr_l);
+    set_reg_long(vm, reg_idx_vx, l);
     *pc = *pc + 2;
     return 0;
 }
@@ -2974,15 +2942,12 @@ static int op_int_to_double(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
 {
     int reg_idx_vx = 0;
     int reg_idx_vy = 0;
-    int reg_idx_vz = 0;
     double d = 0;
-    unsigned char *ptr_d = (unsigned char *) &d;
     int i = 0;
     reg_idx_vx = ptr[*pc + 1] & 0x0F;
-    reg_idx_vz = reg_idx_vx + 1;
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F;
 
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &i);
+    i = get_reg_int(vm, reg_idx_vy);
 
     d = (double)i;
     if (is_verbose()) {
@@ -2990,8 +2955,7 @@ static int op_int_to_double(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
         printf("(%d) to (%f) \n", i , d);
     }
 
-    store_double_to_reg(vm, reg_idx_vx , ptr_d + 4);
-    store_double_to_reg(vm, reg_idx_vz , ptr_d);
+    set_reg_double(vm, reg_idx_vx, d);
     *pc = *pc + 2;
     return 0;
 }
@@ -3005,7 +2969,7 @@ static int op_int_to_char(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
 {
     int reg_idx_vx = 0;
     int reg_idx_vy = 0;
-	char c = 0;
+	ushort c = 0;
     int i = 0;
 
     if (is_verbose()) {
@@ -3015,9 +2979,9 @@ static int op_int_to_char(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int
 
     reg_idx_vx = ptr[*pc + 1] & 0x0F;
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F; 
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &i); 
-    c = (char)i; 
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &c);
+    i = get_reg_int(vm, reg_idx_vy); 
+    c = (ushort)i; 
+    set_reg_int(vm, reg_idx_vx, c);
     *pc = *pc + 2;
     return 0;
 }
@@ -3031,16 +2995,12 @@ static int op_double_to_int(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
 {
     int reg_idx_vx = 0;
     int reg_idx_vy = 0;
-    int reg_idx_vz = 0;
     double d = 0;
-    unsigned char *ptr_d = (unsigned char *) &d;
     int i = 0;
     reg_idx_vx = ptr[*pc + 1] & 0x0F;
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F;
-    reg_idx_vz = reg_idx_vy + 1;
 
-    load_reg_to_double(vm, reg_idx_vy , ptr_d + 4);
-    load_reg_to_double(vm, reg_idx_vz , ptr_d);
+    d = get_reg_double(vm, reg_idx_vy);
 
     i = (int)d;
     if (is_verbose()) {
@@ -3048,7 +3008,7 @@ static int op_double_to_int(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
         printf("(%f) to (%d) \n", d , i);
     }
 
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &i);
+    set_reg_int(vm, reg_idx_vx, i);
     *pc = *pc + 2;
     return 0;
 }
@@ -3066,10 +3026,10 @@ static int op_add_int_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F ;
     if (is_verbose())
         printf("add-int/2addr v%d, v%d\n", reg_idx_vx, reg_idx_vy);
-    load_reg_to(vm, reg_idx_vx, (unsigned char *) &x);
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    x = get_reg_int(vm, reg_idx_vx);
+    y = get_reg_int(vm, reg_idx_vy);
     x = x + y;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 2;
     return 0;
@@ -3088,10 +3048,10 @@ static int op_sub_int_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F ;
     if (is_verbose())
         printf("sub-int/2addr v%d, v%d\n", reg_idx_vx, reg_idx_vy);
-    load_reg_to(vm, reg_idx_vx, (unsigned char *) &x);
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    x = get_reg_int(vm, reg_idx_vx);
+    y = get_reg_int(vm, reg_idx_vy);
     x = x - y;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 2;
     return 0;
@@ -3110,13 +3070,10 @@ static int op_sub_long_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr,
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F ;
     if (is_verbose())
         printf("sub-long/2addr v%d, v%d\n", reg_idx_vx, reg_idx_vy);
-    load_reg_to_double(vm, reg_idx_vx, (unsigned char *) &x + 4);
-    load_reg_to_double(vm, reg_idx_vx + 1, (unsigned char *) &x);
-    load_reg_to_double(vm, reg_idx_vy, (unsigned char *) &y + 4);
-    load_reg_to_double(vm, reg_idx_vy + 1, (unsigned char *) &y);
+    x = get_reg_long(vm, reg_idx_vx);
+    y = get_reg_long(vm, reg_idx_vy);
     x = x - y;
-    store_double_to_reg(vm, reg_idx_vx, (unsigned char *) &x + 4);
-    store_double_to_reg(vm, reg_idx_vx + 1, (unsigned char *) &x);
+    set_reg_long(vm, reg_idx_vx, x);
 
     *pc = *pc + 2;
     return 0;
@@ -3135,13 +3092,10 @@ static int op_mul_long_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr,
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F ;
     if (is_verbose())
         printf("mul-long/2addr v%d, v%d\n", reg_idx_vx, reg_idx_vy);
-    load_reg_to_double(vm, reg_idx_vx, (unsigned char *) &x + 4);
-    load_reg_to_double(vm, reg_idx_vx + 1, (unsigned char *) &x);
-    load_reg_to_double(vm, reg_idx_vy, (unsigned char *) &y + 4);
-    load_reg_to_double(vm, reg_idx_vy + 1, (unsigned char *) &y);
+    x = get_reg_long(vm, reg_idx_vx);
+    y = get_reg_long(vm, reg_idx_vy);
     x = x * y;
-    store_double_to_reg(vm, reg_idx_vx, (unsigned char *) &x + 4);
-    store_double_to_reg(vm, reg_idx_vx + 1, (unsigned char *) &x);
+    set_reg_long(vm, reg_idx_vx, x);
 
     *pc = *pc + 2;
     return 0;
@@ -3157,15 +3111,11 @@ static int op_add_double_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr
     int reg_idx_vx = 0;
     int reg_idx_vy = 0;
     double x = 0.0, y = 0.0;
-    unsigned char *ptr_x = (unsigned char *) &x;
-    unsigned char *ptr_y = (unsigned char *) &y;
     reg_idx_vx = ptr[*pc + 1] & 0x0F;
     reg_idx_vy = (ptr[*pc + 1] >> 4) & 0x0F;
 
-    load_reg_to_double(vm, reg_idx_vx, ptr_x + 4);
-    load_reg_to_double(vm, reg_idx_vx + 1, ptr_x);
-    load_reg_to_double(vm, reg_idx_vy, ptr_y + 4);
-    load_reg_to_double(vm, reg_idx_vy + 1, ptr_y);
+    x = get_reg_double(vm, reg_idx_vx);
+    y = get_reg_double(vm, reg_idx_vy);
 
 
     if (is_verbose()) {
@@ -3173,8 +3123,7 @@ static int op_add_double_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr
         printf("%f(%llx) + %f(%llx) = %f\n", x, x, y, y , y + x);
     }
     x = x + y;
-    store_double_to_reg(vm, reg_idx_vx, ptr_x + 4);
-    store_double_to_reg(vm, reg_idx_vx + 1, ptr_x);
+    set_reg_double(vm, reg_idx_vx, x);
     *pc = *pc + 2;
     return 0;
 }
@@ -3188,23 +3137,14 @@ static int op_add_double_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr
 static int op_mul_double_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
 {
     int reg_idx_vx = 0;
-    int reg_idx_vy = 0;
     int reg_idx_vz = 0;
-    int reg_idx_vw = 0;
     double x = 0.0, y = 0.0;
-    unsigned char *ptr_x = (unsigned char *) &x;
-    unsigned char *ptr_y = (unsigned char *) &y;
 
     reg_idx_vx = ptr[*pc + 1] & 0x0F;
-    reg_idx_vy = reg_idx_vx + 1;
     reg_idx_vz = (ptr[*pc + 1] >> 4) & 0x0F;
-    reg_idx_vw = reg_idx_vz + 1 ;
 
-    load_reg_to_double(vm, reg_idx_vx, ptr_x + 4);
-    load_reg_to_double(vm, reg_idx_vy, ptr_x);
-
-    load_reg_to_double(vm, reg_idx_vz, ptr_y + 4);
-    load_reg_to_double(vm, reg_idx_vw, ptr_y);
+    x = get_reg_double(vm, reg_idx_vx);
+    y = get_reg_double(vm, reg_idx_vz);
 
     if (is_verbose()) {
         printf("mul-double/2addr v%d, v%d\n", reg_idx_vx, reg_idx_vz);
@@ -3213,11 +3153,7 @@ static int op_mul_double_2addr(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr
 
     x = x * y;
 
-    store_double_to_reg(vm, reg_idx_vx, ptr_x + 4);
-    store_double_to_reg(vm, reg_idx_vy, ptr_x);
-
-    load_reg_to_double(vm, reg_idx_vx, ptr_y + 4);
-    load_reg_to_double(vm, reg_idx_vy, ptr_y);
+    set_reg_double(vm, reg_idx_vx, x);
 
     *pc = *pc + 2;
     return 0;
@@ -3236,14 +3172,14 @@ static int op_add_int_lit8(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
     int z = 0;
     reg_idx_vx = ptr[*pc + 1];
     reg_idx_vy = ptr[*pc + 2];
-    z = ptr[*pc + 3];
+    z = (signed char) ptr[*pc + 3];
 
     if (is_verbose())
         printf("add-int/lit8 v%d, v%d, #int%d\n", reg_idx_vx, reg_idx_vy, z);
     /* x = y + z */
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    y = get_reg_int(vm, reg_idx_vy);
     x = y + z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 4;
     return 0;
@@ -3262,13 +3198,13 @@ static int op_rsub_int_lit8(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, i
     int z = 0;
     reg_idx_vx = ptr[*pc + 1];
     reg_idx_vy = ptr[*pc + 2];
-    z = ptr[*pc + 3];
+    z = (signed char) ptr[*pc + 3];
 
     if (is_verbose())
         printf("rsub-int/lit8 v%d, v%d, #int%d\n", reg_idx_vx, reg_idx_vy, z);
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    y = get_reg_int(vm, reg_idx_vy);
     x = z - y;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 4;
     return 0;
@@ -3287,13 +3223,13 @@ static int op_mul_int_lit8(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
     int z = 0;
     reg_idx_vx = ptr[*pc + 1];
     reg_idx_vy = ptr[*pc + 2];
-    z = ptr[*pc + 3];
+    z = (signed char) ptr[*pc + 3];
 
     if (is_verbose())
         printf("mul-int/lit8 v%d, v%d, #int%d\n", reg_idx_vx, reg_idx_vy, z);
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    y = get_reg_int(vm, reg_idx_vy);
     x = y * z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 4;
     return 0;
@@ -3312,14 +3248,14 @@ static int op_div_int_lit8(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
     int z = 0;
     reg_idx_vx = ptr[*pc + 1];
     reg_idx_vy = ptr[*pc + 2];
-    z = ptr[*pc + 3];
+    z = (signed char) ptr[*pc + 3];
 
     if (is_verbose())
         printf("div-int/lit8 v%d, v%d, #int%d\n", reg_idx_vx, reg_idx_vy, z);
 
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    y = get_reg_int(vm, reg_idx_vy);
     x = y / z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 4;
     return 0;
@@ -3338,13 +3274,13 @@ static int op_rem_int_lit8(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
     int z = 0;
     reg_idx_vx = ptr[*pc + 1];
     reg_idx_vy = ptr[*pc + 2];
-    z = ptr[*pc + 3];
+    z = (signed char) ptr[*pc + 3];
 
     if (is_verbose())
         printf("rem-int/lit8 v%d, v%d, #int%d\n", reg_idx_vx, reg_idx_vy, z);
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    y = get_reg_int(vm, reg_idx_vy);
     x = y % z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 4;
     return 0;
@@ -3363,13 +3299,13 @@ static int op_and_int_lit8(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, in
     int z = 0;
     reg_idx_vx = ptr[*pc + 1];
     reg_idx_vy = ptr[*pc + 2];
-    z = ptr[*pc + 3];
+    z = (signed char) ptr[*pc + 3];
 
     if (is_verbose())
         printf("and-int/lit8 v%d, v%d, #int%d\n", reg_idx_vx, reg_idx_vy, z);
-    load_reg_to(vm, reg_idx_vy, (unsigned char *) &y);
+    y = get_reg_int(vm, reg_idx_vy);
     x = y & z;
-    store_to_reg(vm, reg_idx_vx, (unsigned char *) &x);
+    set_reg_int(vm, reg_idx_vx, x);
 
     *pc = *pc + 4;
     return 0;
@@ -3392,9 +3328,11 @@ static byteCode byteCodes[] = {
     { "const-wide/high16" , 0x19, 4,  op_const_wide_high16 },
     { "const-string"      , 0x1a, 4,  op_const_string },
     { "const-class"       , 0x1c, 4,  op_const_class },
+    { "array-length"      , 0x21, 2,  op_array_length },
     { "new-instance"      , 0x22, 4,  op_new_instance },
     { "new-array"         , 0x23, 4,  op_new_array },
     { "filled-new-array"  , 0x24, 6,  op_filled_new_array },
+    { "fill-array-data"   , 0x26, 6,  op_fill_array_data },
     { "goto"			  , 0x28, 2,  op_goto },
     { "goto/16"			  , 0x29, 2,  op_goto_16 },
     { "goto/32"			  , 0x2a, 2,  op_goto_32 },
@@ -3481,204 +3419,1063 @@ static byteCode byteCodes[] = {
 };
 static int byteCode_size = sizeof(byteCodes) / sizeof(byteCode);
 
-static opCodeFunc findOpCodeFunc(unsigned char op)
+/*
+ * Direct-indexed dispatch table, filled from byteCodes[] by
+ * init_opCodeTable() so runMethod() looks up a handler in O(1).
+ */
+static opCodeFunc opCodeTable[256];
+
+static int op_unimplemented(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, int *pc)
+{
+    printRegs(vm);
+    printf("Unknow OpCode =%02x \n", ptr[*pc]);
+    return -1;
+}
+
+static void init_opCodeTable(void)
 {
+    static int initialized = 0;
     int i = 0;
+
+    if (initialized)
+        return;
+    for (i = 0; i < 256; i++)
+        opCodeTable[i] = op_unimplemented;
     for (i = 0; i < byteCode_size; i++)
-        if (op == byteCodes[i].opCode)
-            return byteCodes[i].func;
-    return 0;
+        opCodeTable[byteCodes[i].opCode] = byteCodes[i].func;
+    initialized = 1;
 }
 
-void stack_push(simple_dalvik_vm *vm, u4 data)
+/*
+ * Reserve a zeroed window of size registers on top of the register stack.
+ * Windows are kept by offset, so vm->regs is rebased when the stack grows.
+ */
+static int push_reg_window(simple_dalvik_vm *vm, uint size)
 {
-	u1 *sp = vm->sp - 4;
-	u1 *ptr = (u1 *)&data;
+	uint base = vm->regs - vm->reg_stack;
+
+	if (vm->reg_top + size > vm->reg_stack_size)
+	{
+		uint new_size = vm->reg_stack_size * 2;
+		simple_dvm_register *stack;
 
-	memcpy(sp, ptr, 4);
-	vm->sp = sp;
+		while (vm->reg_top + size > new_size)
+			new_size *= 2;
+		stack = realloc(vm->reg_stack, new_size * sizeof(simple_dvm_register));
+		if (!stack)
+		{
+			printf("cannot grow register stack to %u registers\n", new_size);
+			return -1;
+		}
+		if (is_verbose())
+			printf("register stack: %u -> %u registers\n",
+					vm->reg_stack_size, new_size);
+		vm->reg_stack = stack;
+		vm->reg_stack_size = new_size;
+		vm->regs = stack + base;
+	}
+
+	memset(vm->reg_stack + vm->reg_top, 0, size * sizeof(simple_dvm_register));
+	vm->reg_top += size;
+	return 0;
 }
 
-u4 stack_pop(simple_dalvik_vm *vm)
+/*
+ * Report an uncaught error such as StackOverflowError with the innermost
+ * frames of the trace, then unwind the whole call stack
+ */
+static void throw_uncaught(DexFileFormat *dex, simple_dalvik_vm *vm, const char *error)
 {
-	u1 *sp = vm->sp;
-	u4 value;
+	uint depth = vm->frame_count;
+	int i;
+
+	printf("Exception in thread \"main\" %s\n", error);
+	while (depth > 0 && vm->frame_count - depth < 10)
+	{
+		encoded_method *m = vm->frames[--depth].method;
 
-	memcpy(&value, sp, 4);
-	vm->sp += 4;
+		for (i = 0; i < dex->header.methodIdsSize; i++)
+			if (dex->method_index[i] == m)
+				break;
+		if (i < dex->header.methodIdsSize)
+			printf("\tat %s.%s\n",
+					get_type_item_name(dex, get_method_item(dex, i)->class_idx),
+					get_string_data(dex, get_method_item(dex, i)->name_idx));
+	}
+	if (depth > 0)
+		printf("\t... %u more\n", depth);
 
-	return value;
+	vm->frame_count = 0;
+	vm->fp = NULL;
+	vm->reg_top = 0;
+	vm->regs = vm->reg_stack;
 }
 
-int new_invoke_frame(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m)
+/*
+ * Run the collection an allocation asked for.  Only called between
+ * instructions, where every live object is reachable from a register,
+ * a field or vm->result rather than from a handler's locals.
+ */
+static void gc_safepoint(DexFileFormat *dex, simple_dalvik_vm *vm)
 {
-	int ins_size = m->code_item.ins_size;
-	int reg_size = m->code_item.registers_size;
-	int idx;
+	if (gc_collect(vm))
+		throw_uncaught(dex, vm, "java.lang.OutOfMemoryError: Java heap space");
+}
 
-	/* step 1: Push pc & fp */
-	stack_push(vm, vm->pc);
-	stack_push(vm, (u4)vm->fp);
+/*
+ * Make room for one more frame record; the stack is addressed by depth, so
+ * only vm->fp has to follow it when it moves.
+ */
+static int grow_frame_stack(simple_dalvik_vm *vm)
+{
+	uint new_size = vm->frame_capacity * 2;
+	vm_frame *frames;
 
-	/* step 2: Push caller registers */
-	for (idx = 0; idx < reg_size; idx++)
+	frames = realloc(vm->frames, new_size * sizeof(vm_frame));
+	if (!frames)
 	{
-		u4 value;
+		printf("cannot grow frame stack to %u frames\n", new_size);
+		return -1;
+	}
+	if (is_verbose())
+		printf("frame stack: %u -> %u frames\n", vm->frame_capacity, new_size);
+	vm->frames = frames;
+	vm->frame_capacity = new_size;
+	vm->fp = vm->frame_count ? frames + vm->frame_count - 1 : NULL;
+	return 0;
+}
 
-		load_reg_to(vm, idx, (u1 *)&value);
-		stack_push(vm, value);
+/*
+ * Push a frame record for m, returning to vm->pc of the caller, and a fresh
+ * window of registers_size registers whose last ins_size registers receive
+ * the arguments listed in p (none when p is NULL).  The caller's registers
+ * stay where they are, so the cost does not depend on its register count.
+ * On return the callee is the running frame and vm->pc is 0.
+ */
+int new_invoke_frame(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m, invoke_parameters *p)
+{
+	code_item *code = get_code_item(dex, m);
+	int ins_size = code->ins_size;
+	int reg_size = code->registers_size;
+	uint caller = vm->regs - vm->reg_stack;
+	uint callee = vm->reg_top;
+	simple_dvm_register *ins;
+	vm_frame *frame;
+	int idx;
+
+	if ((vm->frame_count + 1) * sizeof(vm_frame) +
+		(vm->reg_top + reg_size) * sizeof(simple_dvm_register) > get_stack_size())
+	{
+		throw_uncaught(dex, vm, "java.lang.StackOverflowError");
+		return -1;
 	}
-	stack_push(vm, reg_size);
+	if (vm->frame_count == vm->frame_capacity && grow_frame_stack(vm))
+		return -1;
+	if (push_reg_window(vm, reg_size))
+		return -1;
 
-	/* step 3: Update current fp */
-	vm->fp = vm->sp;
+	/* step 1: Push the frame record */
+	frame = &vm->frames[vm->frame_count++];
+	frame->method = m;
+	frame->return_pc = vm->pc;
+	frame->regs = callee;
+
+	/* step 2: Copy the arguments into the callee's in registers */
+	ins = vm->reg_stack + callee + reg_size - ins_size;
+	for (idx = 0; p && idx < ins_size; idx++)
+	{
+		if (is_verbose())
+			printf("reg %d --> %d\n", p->reg_idx[idx], reg_size - ins_size + idx);
+		ins[idx] = vm->reg_stack[caller + p->reg_idx[idx]];
+	}
+	vm->regs = vm->reg_stack + callee;
+
+	/* step 3: Switch to the callee */
+	vm->fp = frame;
+	vm->pc = 0;
 
 	return 0;
 }
 
-void runMethod(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m)
+/*
+ * Length in code units of an instruction, by opcode
+ */
+static int insn_width(u1 op)
+{
+    switch (op) {
+    case 0x02: case 0x05: case 0x08: case 0x13: case 0x15: case 0x16:
+    case 0x19: case 0x1a: case 0x1c: case 0x1f: case 0x20: case 0x22:
+    case 0x23: case 0x29:
+        return 2;
+    case 0x03: case 0x06: case 0x09: case 0x14: case 0x17: case 0x1b:
+    case 0x24: case 0x25: case 0x26: case 0x2a: case 0x2b: case 0x2c:
+        return 3;
+    case 0x18:
+        return 5;
+    default:
+        break;
+    }
+    if ((op >= 0x2d && op <= 0x3d) || (op >= 0x44 && op <= 0x6d) ||
+        (op >= 0x90 && op <= 0xaf) || (op >= 0xd0 && op <= 0xe2))
+        return 2;
+    if (op >= 0x6e && op <= 0x78)
+        return 3;
+    return 1;
+}
+
+/*
+ * Length in code units of a packed-switch, sparse-switch or
+ * fill-array-data payload starting at pc
+ */
+static int payload_width(u1 *ptr, int pc)
+{
+    uint size = ptr[pc + 3] << 8 | ptr[pc + 2];
+    uint count;
+
+    switch (ptr[pc + 1]) {
+    case 0x01:
+        return 4 + size * 2;
+    case 0x02:
+        return 2 + size * 4;
+    case 0x03:
+        /* size is the element width here */
+        count = ptr[pc + 7] << 24 | ptr[pc + 6] << 16 | ptr[pc + 5] << 8 | ptr[pc + 4];
+        return 4 + (size * count + 1) / 2;
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Unpack the operands of the instruction at pc into insn. Register and
+ * index operands follow the Dalvik format notation (vA, vB, vC); literals
+ * are stored the way the corresponding opCodeFunc handler interprets them.
+ */
+static void decode_operands(decoded_insn *insn, u1 *ptr, int pc)
 {
-    u1 *ptr = (u1 *) m->code_item.insns;
-    unsigned char opCode = 0;
-    opCodeFunc func = 0;
+    u1 op = ptr[pc];
+    int u16 = ptr[pc + 3] << 8 | ptr[pc + 2];
+    int u32 = ptr[pc + 5] << 24 | ptr[pc + 4] << 16 | u16;
 
-    while (1) {
-        if (vm->returned || vm->pc >= m->code_item.insns_size * sizeof(ushort)) {
-			vm->returned = 0;
-            break;
-		}
-        opCode = ptr[vm->pc];
-        func = findOpCodeFunc(opCode);
-        if (func != 0) {
-            if (func(dex, vm, ptr, &vm->pc))
-	        break;
-        } else {
-            printRegs(vm);
-            printf("Unknow OpCode =%02x \n", opCode);
-            break;
+    insn->va = ptr[pc + 1];
+
+    switch (op) {
+    case 0x01: case 0x04: case 0x07: case 0x21:
+        insn->va = ptr[pc + 1] & 0x0F;
+        insn->vb = (ptr[pc + 1] >> 4) & 0x0F;
+        return;
+    case 0x02: case 0x05: case 0x08:
+    case 0x1a: case 0x1c: case 0x1f: case 0x22:
+        insn->vb = u16;
+        return;
+    case 0x12:
+        insn->va = ptr[pc + 1] & 0x0F;
+        insn->literal = ((signed char) ptr[pc + 1]) >> 4;
+        return;
+    case 0x13: case 0x15: case 0x19:
+        insn->literal = u16;
+        return;
+    case 0x16:
+        insn->literal = (signed short) u16;
+        return;
+    case 0x14: case 0x17: case 0x26: case 0x2a: case 0x2b: case 0x2c:
+        insn->literal = u32;
+        return;
+    case 0x20: case 0x23:
+        insn->va = ptr[pc + 1] & 0x0F;
+        insn->vb = (ptr[pc + 1] >> 4) & 0x0F;
+        insn->vc = u16;
+        return;
+    case 0x24: case 0x25:
+        insn->vb = u16;
+        return;
+    case 0x28:
+        insn->literal = (signed char) ptr[pc + 1];
+        return;
+    case 0x29:
+        insn->literal = (signed short) u16;
+        return;
+    default:
+        break;
+    }
+
+    if (op >= 0x32 && op <= 0x37) {
+        insn->va = ptr[pc + 1] & 0x0F;
+        insn->vb = (ptr[pc + 1] >> 4) & 0x0F;
+        insn->literal = (signed short) u16;
+    } else if (op >= 0x38 && op <= 0x3d) {
+        insn->literal = (signed short) u16;
+    } else if ((op >= 0x2d && op <= 0x31) || (op >= 0x44 && op <= 0x51) ||
+               (op >= 0x90 && op <= 0xaf)) {
+        insn->vb = ptr[pc + 2];
+        insn->vc = ptr[pc + 3];
+    } else if (op >= 0x52 && op <= 0x5f) {
+        insn->va = ptr[pc + 1] & 0x0F;
+        insn->vb = (ptr[pc + 1] >> 4) & 0x0F;
+        insn->vc = u16;
+    } else if (op >= 0x60 && op <= 0x6d) {
+        insn->vb = u16;
+    } else if (op >= 0x6e && op <= 0x78) {
+        insn->vb = u16;
+    } else if ((op >= 0x7b && op <= 0x8f) || (op >= 0xb0 && op <= 0xcf)) {
+        insn->va = ptr[pc + 1] & 0x0F;
+        insn->vb = (ptr[pc + 1] >> 4) & 0x0F;
+    } else if (op >= 0xd0 && op <= 0xd7) {
+        insn->va = ptr[pc + 1] & 0x0F;
+        insn->vb = (ptr[pc + 1] >> 4) & 0x0F;
+        insn->literal = (signed short) u16;
+    } else if (op >= 0xd8 && op <= 0xe2) {
+        insn->vb = ptr[pc + 2];
+        insn->literal = (signed char) ptr[pc + 3];
+    }
+}
+
+static int is_branch(int op)
+{
+    return (op >= 0x28 && op <= 0x2a) || (op >= 0x32 && op <= 0x3d);
+}
+
+/*
+ * Return the decoded instruction at byte offset pc, or the OP_END
+ * sentinel if pc does not start an instruction of the method.
+ */
+static decoded_insn *decoded_at(code_item *code, int pc)
+{
+    int idx = -1;
+
+    if (pc >= 0 && pc < code->insns_size * sizeof(ushort) && !(pc & 1))
+        idx = code->decoded_index[pc / 2];
+    if (idx < 0)
+        idx = code->decoded_size;
+    return &code->decoded[idx];
+}
+
+/*
+ * Decode code_item.insns of m into a fixed-width instruction array once,
+ * so the interpreter loops do not re-parse operands on every execution.
+ */
+int decode_method(encoded_method *m)
+{
+    code_item *code = &m->code_item;
+    u1 *ptr = (u1 *) code->insns;
+    int end = code->insns_size * sizeof(ushort);
+    decoded_insn *insn;
+    int count = 0;
+    int pc = 0;
+    int i = 0;
+
+    if (code->decoded)
+        return 0;
+
+    code->decoded_index = (int *) malloc(sizeof(int) * (code->insns_size + 1));
+    code->decoded = (decoded_insn *) malloc(sizeof(decoded_insn) * (code->insns_size + 1));
+    if (!code->decoded_index || !code->decoded) {
+        printf("alloc decoded insns fail\n");
+        free(code->decoded_index);
+        free(code->decoded);
+        code->decoded_index = NULL;
+        code->decoded = NULL;
+        return -1;
+    }
+    for (i = 0; i <= code->insns_size; i++)
+        code->decoded_index[i] = -1;
+
+    /* pass 1: unpack operands, skipping switch and array payloads */
+    while (pc < end) {
+        if (ptr[pc] == 0x00 && ptr[pc + 1] >= 0x01 && ptr[pc + 1] <= 0x03) {
+            pc += payload_width(ptr, pc) * 2;
+            continue;
         }
+        insn = &code->decoded[count];
+        memset(insn, 0, sizeof(decoded_insn));
+        insn->func = opCodeTable[ptr[pc]];
+        insn->pc = pc;
+        insn->opcode = ptr[pc];
+        decode_operands(insn, ptr, pc);
+        code->decoded_index[pc / 2] = count++;
+        pc += insn_width(ptr[pc]) * 2;
     }
+
+    insn = &code->decoded[count];
+    memset(insn, 0, sizeof(decoded_insn));
+    insn->pc = end;
+    insn->opcode = OP_END;
+    code->decoded_size = count;
+
+    /* pass 2: resolve branch offsets to decoded indices */
+    for (i = 0; i < count; i++) {
+        insn = &code->decoded[i];
+        if (is_branch(insn->opcode))
+            insn->target = decoded_at(code, insn->pc + insn->literal * 2) - code->decoded;
+    }
+
+    if (is_verbose() > 2)
+        printf("decoded %d instructions (%d code units)\n", count, code->insns_size);
+
+    return 0;
 }
 
-void runMainMethod(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m)
+/*
+ * Field access quickening.
+ *
+ * The first execution of an iget/iput/sget/sput resolves its field_id and
+ * rewrites the decoded instruction to a quick form for the width of the
+ * field: instance fields become the offset of their slot in the instance
+ * data, static fields the address of their slot in the class statics.
+ * insn->func keeps the original handler as slow path.  Returns 0 if insn
+ * is quickened.
+ */
+static const ushort iget_quick_ops[7] = {
+    OP_IGET_QUICK, OP_IGET_WIDE_QUICK, OP_IGET_QUICK, OP_IGET_BOOLEAN_QUICK,
+    OP_IGET_BYTE_QUICK, OP_IGET_CHAR_QUICK, OP_IGET_SHORT_QUICK,
+};
+static const ushort iput_quick_ops[7] = {
+    OP_IPUT_QUICK, OP_IPUT_WIDE_QUICK, OP_IPUT_OBJECT_QUICK, OP_IPUT_BYTE_QUICK,
+    OP_IPUT_BYTE_QUICK, OP_IPUT_SHORT_QUICK, OP_IPUT_SHORT_QUICK,
+};
+#define STATIC_QUICK_OP(op) ((op) - OP_IGET_QUICK + OP_SGET_QUICK)
+
+static int quicken_field_insn(DexFileFormat *dex, simple_dalvik_vm *vm, decoded_insn *insn)
 {
-    vm->pc = 0;
-    runMethod(dex, vm, m);
+    char full_field_name[255];
+    char *class_name;
+    instance_obj *obj;
+    class_obj *cls;
+    field_info *field;
+    u1 *slot;
+    int op = insn->opcode;
+
+    if (op >= 0x52 && op <= 0x5f) {
+        load_reg_to(vm, insn->vb, (u1 *) &obj);
+        if (!obj)
+            return -1;
+        gen_full_field_name(full_field_name, get_field_class_name(dex, insn->vc),
+                            get_field_item_name(dex, insn->vc));
+        field = find_instance_field(obj->cls, full_field_name);
+        if (!field)
+            return -1;
+        insn->literal = field->offset;
+        if (op < 0x59)
+            insn->opcode = iget_quick_ops[op - 0x52];
+        else
+            insn->opcode = iput_quick_ops[op - 0x59];
+    } else if (op >= 0x60 && op <= 0x6d) {
+        class_name = get_field_class_name(dex, insn->vb);
+        if (!strncmp(class_name, "Ljava", strlen("Ljava")))
+            return -1;
+        cls = find_class_obj_by_type(vm, dex, get_field_item(dex, insn->vb)->class_idx);
+        if (!cls)
+            return -1;
+        if (!find_static_field(cls, get_field_item_name(dex, insn->vb), &slot))
+            return -1;
+        insn->data = slot;
+        if (op < 0x67)
+            insn->opcode = STATIC_QUICK_OP(iget_quick_ops[op - 0x60]);
+        else
+            insn->opcode = STATIC_QUICK_OP(iput_quick_ops[op - 0x67]);
+    } else {
+        return -1;
+    }
+
+    if (is_verbose() > 2)
+        printf("quickened insn at pc %d to 0x%03x\n", insn->pc, insn->opcode);
+    return 0;
+}
+
+/*
+ * Execute a quickened field access. Returns -1 if the receiver does not
+ * fit the resolved slot and the slow path has to run instead.
+ */
+static int run_quick_insn(simple_dalvik_vm *vm, decoded_insn *insn)
+{
+    instance_obj *obj = NULL;
+    void *value;
+    unsigned short c;
+    short s;
+    u1 *slot;
+    int op = insn->opcode;
+
+    if (op < OP_SGET_QUICK) {
+        load_reg_to(vm, insn->vb, (u1 *) &obj);
+        if (!obj || insn->literal >= obj->cls->instance_size)
+            return -1;
+        slot = instance_data(obj) + insn->literal;
+    } else {
+        slot = (u1 *) insn->data;
+        op = op - OP_SGET_QUICK + OP_IGET_QUICK;
+    }
+
+    switch (op) {
+    case OP_IGET_QUICK:
+        store_to_reg(vm, insn->va, slot);
+        break;
+    case OP_IGET_WIDE_QUICK:
+        store_wide_to_reg(vm, insn->va, slot);
+        break;
+    case OP_IGET_BOOLEAN_QUICK:
+        set_reg_int(vm, insn->va, *slot);
+        break;
+    case OP_IGET_BYTE_QUICK:
+        set_reg_int(vm, insn->va, (signed char) *slot);
+        break;
+    case OP_IGET_CHAR_QUICK:
+        memcpy(&c, slot, 2);
+        set_reg_int(vm, insn->va, c);
+        break;
+    case OP_IGET_SHORT_QUICK:
+        memcpy(&s, slot, 2);
+        set_reg_int(vm, insn->va, s);
+        break;
+    case OP_IPUT_QUICK:
+        load_reg_to(vm, insn->va, slot);
+        break;
+    case OP_IPUT_WIDE_QUICK:
+        load_reg_to_wide(vm, insn->va, slot);
+        break;
+    case OP_IPUT_OBJECT_QUICK:
+        load_reg_to(vm, insn->va, (u1 *) &value);
+        memcpy(slot, &value, sizeof(void *));
+        if (obj)
+            heap_write_barrier(&vm->heap, obj, value);
+        else
+            heap_static_barrier(&vm->heap, value);
+        break;
+    case OP_IPUT_BYTE_QUICK:
+        *slot = (u1) get_reg_int(vm, insn->va);
+        break;
+    case OP_IPUT_SHORT_QUICK:
+        s = (short) get_reg_int(vm, insn->va);
+        memcpy(slot, &s, 2);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
 }
 
-encoded_method *find_vmethod(DexFileFormat *dex, instance_obj *ins_obj, int class_idx, int method_name_idx)
+/*
+ * invoke-virtual through the inline cache of the call site insn.
+ *
+ * The cache maps up to INLINE_CACHE_SIZE receiver classes to their
+ * resolved encoded_method, so a warmed-up site never goes through
+ * find_vmethod().  Calls into the java.lang library, null receivers and
+ * unresolvable methods return -1 and take the opCodeFunc slow path.
+ */
+static int invoke_virtual_cached(DexFileFormat *dex, simple_dalvik_vm *vm, u1 *ptr, decoded_insn *insn)
 {
-	int i, j;
-	encoded_method *found = NULL;
-	vtable_item *vtable = ins_obj->cls->vtable;
-	int vtable_size = ins_obj->cls->vtable_size;
-	char *name = get_string_data(dex, method_name_idx);
+    inline_cache *ic = (inline_cache *) insn->data;
+    method_id_item *m = get_method_item(dex, insn->vb);
+    instance_obj *ins_obj;
+    encoded_method *method = NULL;
+    invoke_parameters p;
+    int pc = insn->pc;
+    int i;
 
-	for (i = 0; i < vtable_size; i++)
-	{
-		if (!strcmp(vtable[i].name, name))
-		{
-			found = vtable[i].method;
-			break;
-		}
-	}
+    if (!ic) {
+        ic = (inline_cache *) calloc(1, sizeof(inline_cache));
+        if (!ic)
+            return -1;
+        ic->library = find_java_lang_method(get_type_item_name(dex, m->class_idx),
+                                            get_string_data(dex, m->name_idx));
+        if (ic->library) {
+            type_list *params = get_proto_type_list(dex, m->proto_idx);
+
+            if (params && params->size > 0)
+                ic->library_type = get_type_item_name(dex, params->type_item[0].type_idx);
+        }
+        insn->data = ic;
+    }
 
-	/*
-	for (i = 0; i < dex->header.classDefsSize; i++)
-	{
-		if (dex->class_def_item[i].class_idx == class_idx)
-		{
-			class_data_item *item = &dex->class_data_item[i];
-			int methods_size = item->virtual_methods_size;
-			int aggregated_idx = 0;
+    op_utils_invoke_35c_parse(dex, ptr, &pc, &p);
+    if (ic->library) {
+        /* java_lib methods run right here, like the intrinsics they are */
+        vm->p = p;
+        vm->pc = insn->pc + 6;
+        ic->library->method_runtime(dex, vm, ic->library_type);
+        return 0;
+    }
+    load_reg_to(vm, p.reg_idx[0], (u1 *) &ins_obj);
+    if (!ins_obj)
+        return -1;
 
-			for (j = 0; j < methods_size; j++)
-			{
-				encoded_method *tmp = &item->virtual_methods[j];
-				aggregated_idx += tmp->method_idx_diff;
-				method_id_item *item = &dex->method_id_item[aggregated_idx];
-
-				if (item->name_idx == method_name_idx)
-				{
-					found = tmp;
-					break;
-				}
-			}
+    for (i = 0; i < ic->size; i++) {
+        if (ic->entry[i].cls == ins_obj->cls) {
+            method = ic->entry[i].method;
+            ic->hits++;
+            break;
+        }
+    }
+    if (!method) {
+        method = find_vmethod(dex, ins_obj, insn->vb);
+        if (!method)
+            return -1;
+        ic->misses++;
+        if (ic->size < INLINE_CACHE_SIZE) {
+            ic->entry[ic->size].cls = ins_obj->cls;
+            ic->entry[ic->size].method = method;
+            ic->size++;
+        }
+    }
 
-			if (found)
-				break;
-		}
-	}
-	*/
+    if (is_verbose())
+        printf("invoke-virtual (cached) method_id 0x%04x %s.%s\n", p.method_id,
+               ins_obj->cls->name, get_string_data(dex, m->name_idx));
 
-	return found;
+    vm->p = p;
+    vm->pc = insn->pc + 6;
+    invoke_encoded_method(dex, vm, method, &vm->p);
+    return 0;
 }
 
-encoded_method *find_method_by_name(DexFileFormat *dex, int class_idx, const char *name)
+/*
+ * Print the hit/miss counters of every invoke-virtual inline cache
+ */
+static void print_method_inline_caches(DexFileFormat *dex, encoded_method *m, int size)
+{
+    int i, j;
+
+    for (i = 0; i < size; i++) {
+        int aggregated_idx = 0;
+
+        for (j = 0; j <= i; j++)
+            aggregated_idx += m[j].method_idx_diff;
+        if (!m[i].code_item.decoded)
+            continue;
+        for (j = 0; j < m[i].code_item.decoded_size; j++) {
+            decoded_insn *insn = &m[i].code_item.decoded[j];
+            inline_cache *ic = (inline_cache *) insn->data;
+            method_id_item *callee;
+
+            if (insn->opcode != 0x6e || !ic || ic->library)
+                continue;
+            callee = get_method_item(dex, insn->vb);
+            printf("%s.%s pc %04x -> %s: %d class(es), %u hits, %u misses\n",
+                   get_type_item_name(dex, get_method_item(dex, aggregated_idx)->class_idx),
+                   get_string_data(dex, get_method_item(dex, aggregated_idx)->name_idx),
+                   insn->pc, get_string_data(dex, callee->name_idx),
+                   ic->size, ic->hits, ic->misses);
+        }
+    }
+}
+
+void print_inline_cache_stats(DexFileFormat *dex)
 {
-	int i, j;
-	encoded_method *found = NULL;
+    int i;
 
-	for (i = 0; i < dex->header.classDefsSize; i++)
-	{
-		if (dex->class_def_item[i].class_idx == class_idx)
-		{
-			class_data_item *item = &dex->class_data_item[i];
-			int methods_size = item->direct_methods_size;
-			int aggregated_idx = 0;
+    printf("inline cache statistics:\n");
+    for (i = 0; i < dex->header.classDefsSize; i++) {
+        class_data_item *item = &dex->class_data_item[i];
 
-			for (j = 0; j < methods_size; j++)
-			{
-				encoded_method *tmp = &item->direct_methods[j];
-				aggregated_idx += tmp->method_idx_diff;
-				method_id_item *item = &dex->method_id_item[aggregated_idx]; 
-				if (strcmp(get_string_data(dex, item->name_idx), name) == 0) 
-				{
-					found = tmp;
-					break;
-				}
-			}
+        if (!item->loaded)
+            continue;
+        print_method_inline_caches(dex, item->direct_methods, item->direct_methods_size);
+        print_method_inline_caches(dex, item->virtual_methods, item->virtual_methods_size);
+    }
+}
 
-			if (found)
-				break;
-		}
-	}
+#ifdef CONFIG_THREADED_DISPATCH
+/*
+ * Threaded-code interpreter (GCC labels-as-values).
+ *
+ * Each handler jumps straight to the handler of the next decoded
+ * instruction instead of returning to a central loop.  The instruction
+ * pointer and the register file are kept in locals; the hot integer,
+ * move and branch opcodes are executed inline from their pre-decoded
+ * operands, everything else is delegated to the opCodeFunc handlers.
+ * Invokes and returns switch frames without leaving the loop, which runs
+ * until the call depth drops to stop.
+ */
+static void runMethodThreaded(DexFileFormat *dex, simple_dalvik_vm *vm, uint stop)
+{
+    static void *dispatch[OP_MAX];
+    static int initialized = 0;
+    uint depth;
+    encoded_method *m;
+    u1 *ptr;
+    decoded_insn *code;
+    decoded_insn *ip;
+    int *regs;
+    instance_obj *obj;
+    array_obj *arr;
+    u1 *elem;
+    int i = 0;
 
-	return found;
+    if (!initialized) {
+        for (i = 0; i < OP_END; i++)
+            dispatch[i] = &&op_call;
+        for (i = 0x52; i <= 0x6d; i++)
+            dispatch[i] = &&op_quicken;
+        dispatch[OP_END] = &&done;
+        dispatch[0x6e] = &&op_invoke_virtual;
+        dispatch[0x1a] = &&op_const_string;
+        dispatch[OP_IGET_QUICK] = &&op_iget_quick;
+        dispatch[OP_IPUT_QUICK] = &&op_iput_quick;
+        dispatch[OP_SGET_QUICK] = &&op_sget_quick;
+        dispatch[OP_SPUT_QUICK] = &&op_sput_quick;
+        dispatch[OP_IPUT_OBJECT_QUICK] = &&op_iput_object_quick;
+        dispatch[OP_SPUT_OBJECT_QUICK] = &&op_sput_object_quick;
+        /* wide and narrow slots */
+        for (i = OP_IGET_WIDE_QUICK; i < OP_MAX; i++)
+            if (!dispatch[i])
+                dispatch[i] = &&op_quick;
+        dispatch[0x01] = &&op_move;
+        dispatch[0x0a] = &&op_move_result;
+        dispatch[0x0c] = &&op_move_result;
+        dispatch[0x12] = &&op_const;
+        dispatch[0x13] = &&op_const;
+        dispatch[0x14] = &&op_const;
+        dispatch[0x28] = &&op_goto;
+        dispatch[0x29] = &&op_goto;
+        dispatch[0x2a] = &&op_goto;
+        dispatch[0x32] = &&op_if_eq;
+        dispatch[0x33] = &&op_if_ne;
+        dispatch[0x34] = &&op_if_lt;
+        dispatch[0x35] = &&op_if_ge;
+        dispatch[0x36] = &&op_if_gt;
+        dispatch[0x37] = &&op_if_le;
+        dispatch[0x38] = &&op_if_eqz;
+        dispatch[0x39] = &&op_if_nez;
+        dispatch[0x3a] = &&op_if_ltz;
+        dispatch[0x3b] = &&op_if_gez;
+        dispatch[0x3c] = &&op_if_gtz;
+        dispatch[0x3d] = &&op_if_lez;
+        dispatch[0x44] = &&op_aget;
+        dispatch[0x47] = &&op_aget_boolean;
+        dispatch[0x48] = &&op_aget_byte;
+        dispatch[0x49] = &&op_aget_char;
+        dispatch[0x4a] = &&op_aget_short;
+        dispatch[0x4b] = &&op_aput;
+        dispatch[0x4e] = &&op_aput_byte;
+        dispatch[0x4f] = &&op_aput_byte;
+        dispatch[0x50] = &&op_aput_short;
+        dispatch[0x51] = &&op_aput_short;
+        dispatch[0x90] = &&op_add_int;
+        dispatch[0x91] = &&op_sub_int;
+        dispatch[0x92] = &&op_mul_int;
+        dispatch[0xb0] = &&op_add_int_2addr;
+        dispatch[0xb1] = &&op_sub_int_2addr;
+        dispatch[0xd8] = &&op_add_int_lit8;
+        initialized = 1;
+    }
+
+#define DISPATCH()      goto *dispatch[ip->opcode]
+#define NEXT()          do { ip++; DISPATCH(); } while (0)
+#define JUMP()          do { ip = code + ip->target; DISPATCH(); } while (0)
+#define IF_CMP(cond)    do { if (cond) JUMP(); NEXT(); } while (0)
+/* Point elem at element vc of array vb; the opCodeFunc handler reports
+ * null arrays, bad indices and mismatched widths */
+#define ARRAY_ELEM(w)   do { \
+        obj = (instance_obj *) regs[ip->vb]; \
+        if (!obj) goto op_call; \
+        arr = (array_obj *) obj->priv_data; \
+        if ((uint) regs[ip->vc] >= (uint) arr->size || arr->width != (w)) \
+            goto op_call; \
+        elem = arr->data + regs[ip->vc] * (w); \
+    } while (0)
+
+frame_changed:
+    if (vm->frame_count <= stop)
+        return;
+    depth = vm->frame_count;
+    m = vm->fp->method;
+    if (decode_method(m)) {
+        op_utils_return(vm);
+        goto frame_changed;
+    }
+    ptr = (u1 *) m->code_item.insns;
+    code = m->code_item.decoded;
+    ip = decoded_at(&m->code_item, vm->pc);
+    regs = (int *) vm->regs;
+    DISPATCH();
+
+op_call:
+    vm->pc = ip->pc;
+    if (ip->func(dex, vm, ptr, (int *) &vm->pc)) {
+        /* a failing instruction abandons its method */
+        op_utils_return(vm);
+        goto frame_changed;
+    }
+    if (vm->heap.gc_pending)
+        gc_safepoint(dex, vm);
+    if (vm->frame_count != depth)
+        goto frame_changed;
+    /* a <clinit> run by the handler may have grown the register stack */
+    regs = (int *) vm->regs;
+    ip = decoded_at(&m->code_item, vm->pc);
+    DISPATCH();
+
+op_invoke_virtual:
+    if (invoke_virtual_cached(dex, vm, ptr, ip))
+        goto op_call;
+    /* a library method may have allocated */
+    if (vm->heap.gc_pending)
+        gc_safepoint(dex, vm);
+    goto frame_changed;
+op_const_string:
+    if (!vm->strings || !vm->strings[ip->vb])
+        goto op_call;
+    regs[ip->va] = (int) vm->strings[ip->vb];
+    NEXT();
+op_quicken:
+    /* resolving a static field may run <clinit> */
+    if (quicken_field_insn(dex, vm, ip))
+        goto op_call;
+    regs = (int *) vm->regs;
+    DISPATCH();
+op_quick:
+    if (run_quick_insn(vm, ip))
+        goto op_call;
+    NEXT();
+op_iget_quick:
+    obj = (instance_obj *) regs[ip->vb];
+    if (!obj || ip->literal >= obj->cls->instance_size)
+        goto op_call;
+    memcpy(&regs[ip->va], instance_data(obj) + ip->literal, 4);
+    NEXT();
+op_iput_quick:
+    obj = (instance_obj *) regs[ip->vb];
+    if (!obj || ip->literal >= obj->cls->instance_size)
+        goto op_call;
+    memcpy(instance_data(obj) + ip->literal, &regs[ip->va], 4);
+    NEXT();
+op_sget_quick:
+    memcpy(&regs[ip->va], ip->data, 4);
+    NEXT();
+op_sput_quick:
+    memcpy(ip->data, &regs[ip->va], 4);
+    NEXT();
+op_iput_object_quick:
+    obj = (instance_obj *) regs[ip->vb];
+    if (!obj || ip->literal >= obj->cls->instance_size)
+        goto op_call;
+    memcpy(instance_data(obj) + ip->literal, &regs[ip->va], 4);
+    heap_write_barrier(&vm->heap, obj, (void *) regs[ip->va]);
+    NEXT();
+op_sput_object_quick:
+    memcpy(ip->data, &regs[ip->va], 4);
+    heap_static_barrier(&vm->heap, (void *) regs[ip->va]);
+    NEXT();
+
+op_move:
+    regs[ip->va] = regs[ip->vb];
+    NEXT();
+op_move_result:
+    regs[ip->va] = vm->result[0];
+    NEXT();
+op_const:
+    regs[ip->va] = ip->literal;
+    NEXT();
+op_goto:
+    JUMP();
+op_if_eq:
+    IF_CMP(regs[ip->va] == regs[ip->vb]);
+op_if_ne:
+    IF_CMP(regs[ip->va] != regs[ip->vb]);
+op_if_lt:
+    IF_CMP(regs[ip->va] < regs[ip->vb]);
+op_if_ge:
+    IF_CMP(regs[ip->va] >= regs[ip->vb]);
+op_if_gt:
+    IF_CMP(regs[ip->va] > regs[ip->vb]);
+op_if_le:
+    IF_CMP(regs[ip->va] <= regs[ip->vb]);
+op_if_eqz:
+    IF_CMP(regs[ip->va] == 0);
+op_if_nez:
+    IF_CMP(regs[ip->va] != 0);
+op_if_ltz:
+    IF_CMP(regs[ip->va] < 0);
+op_if_gez:
+    IF_CMP(regs[ip->va] >= 0);
+op_if_gtz:
+    IF_CMP(regs[ip->va] > 0);
+op_if_lez:
+    IF_CMP(regs[ip->va] <= 0);
+op_aget:
+    ARRAY_ELEM(4);
+    regs[ip->va] = *(int *) elem;
+    NEXT();
+op_aget_boolean:
+    ARRAY_ELEM(1);
+    regs[ip->va] = *elem;
+    NEXT();
+op_aget_byte:
+    ARRAY_ELEM(1);
+    regs[ip->va] = *(signed char *) elem;
+    NEXT();
+op_aget_char:
+    ARRAY_ELEM(2);
+    regs[ip->va] = *(unsigned short *) elem;
+    NEXT();
+op_aget_short:
+    ARRAY_ELEM(2);
+    regs[ip->va] = *(short *) elem;
+    NEXT();
+op_aput:
+    ARRAY_ELEM(4);
+    *(int *) elem = regs[ip->va];
+    NEXT();
+op_aput_byte:
+    ARRAY_ELEM(1);
+    *elem = regs[ip->va];
+    NEXT();
+op_aput_short:
+    ARRAY_ELEM(2);
+    *(short *) elem = regs[ip->va];
+    NEXT();
+op_add_int:
+    regs[ip->va] = regs[ip->vb] + regs[ip->vc];
+    NEXT();
+op_sub_int:
+    regs[ip->va] = regs[ip->vb] - regs[ip->vc];
+    NEXT();
+op_mul_int:
+    regs[ip->va] = regs[ip->vb] * regs[ip->vc];
+    NEXT();
+op_add_int_2addr:
+    regs[ip->va] = regs[ip->va] + regs[ip->vb];
+    NEXT();
+op_sub_int_2addr:
+    regs[ip->va] = regs[ip->va] - regs[ip->vb];
+    NEXT();
+op_add_int_lit8:
+    regs[ip->va] = regs[ip->vb] + ip->literal;
+    NEXT();
+
+done:
+    /* falling off the end of the code returns void */
+    op_utils_return(vm);
+    goto frame_changed;
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef IF_CMP
+#undef ARRAY_ELEM
+}
+#endif
+
+/*
+ * Run the current frame until it returns.  Calls and returns made by the
+ * method only switch frames and stay in this loop; a nested runMethod() is
+ * needed only when a handler must see a callee finish, e.g. <clinit>.
+ */
+void runMethod(DexFileFormat *dex, simple_dalvik_vm *vm)
+{
+    uint stop = vm->frame_count - 1;
+    uint depth;
+    encoded_method *m;
+    u1 *ptr;
+    decoded_insn *insn;
+
+#ifdef CONFIG_THREADED_DISPATCH
+    /* verbose tracing is only implemented by the opCodeFunc handlers */
+    if (!is_verbose()) {
+        runMethodThreaded(dex, vm, stop);
+        return;
+    }
+#endif
+
+    while (vm->frame_count > stop) {
+        depth = vm->frame_count;
+        m = vm->fp->method;
+        if (decode_method(m)) {
+            op_utils_return(vm);
+            continue;
+        }
+        ptr = (u1 *) m->code_item.insns;
+        insn = decoded_at(&m->code_item, vm->pc);
+        while (1) {
+            if (insn->opcode == OP_END) {
+                /* falling off the end of the code returns void */
+                op_utils_return(vm);
+                break;
+            }
+            if (insn->opcode == 0x6e && !invoke_virtual_cached(dex, vm, ptr, insn))
+                break;
+            /* field accesses are only quickened when not tracing */
+            if (!is_verbose() && (insn->opcode > OP_END ||
+                                  !quicken_field_insn(dex, vm, insn))) {
+                if (!run_quick_insn(vm, insn)) {
+                    insn++;
+                    continue;
+                }
+            }
+            vm->pc = insn->pc;
+            if (insn->func(dex, vm, ptr, (int *) &vm->pc)) {
+                /* a failing instruction abandons its method */
+                op_utils_return(vm);
+                break;
+            }
+            if (vm->heap.gc_pending)
+                gc_safepoint(dex, vm);
+            if (vm->frame_count != depth)
+                break;
+            insn = decoded_at(&m->code_item, vm->pc);
+        }
+    }
 }
 
-encoded_method *find_method(DexFileFormat *dex, int class_idx, int method_name_idx)
+void runMainMethod(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m)
 {
-	int i, j;
-	encoded_method *found = NULL;
+    vm->pc = 0;
+    if (!new_invoke_frame(dex, vm, m, NULL))
+        runMethod(dex, vm);
+}
 
-	for (i = 0; i < dex->header.classDefsSize; i++)
+/*
+ * Resolve method_id against the receiver's vtable.  The slot comes from the
+ * vtable_map of the class that method_id names, which is the receiver's class
+ * or one of its ancestors.  Methods named through a class outside the dex
+ * (e.g. Object.toString) are matched by name and prototype instead.
+ */
+encoded_method *find_vmethod(DexFileFormat *dex, instance_obj *ins_obj, int method_id)
+{
+	class_obj *cls;
+	int i;
+
+	for (cls = ins_obj->cls; cls; cls = cls->parent)
 	{
-		if (dex->class_def_item[i].class_idx == class_idx)
+		if (method_id >= cls->vtable_map_base &&
+			method_id < cls->vtable_map_base + cls->vtable_map_size)
 		{
-			class_data_item *item = &dex->class_data_item[i];
-			int methods_size = item->direct_methods_size;
-			int aggregated_idx = 0;
-
-			for (j = 0; j < methods_size; j++)
-			{
-				encoded_method *tmp = &item->direct_methods[j];
-				aggregated_idx += tmp->method_idx_diff;
-				method_id_item *item = &dex->method_id_item[aggregated_idx];
-
-				if (item->name_idx == method_name_idx)
-				{
-					found = tmp;
-					break;
-				}
-			}
+			int slot = cls->vtable_map[method_id - cls->vtable_map_base];
 
-			if (found)
-				break;
+			return (slot < 0) ? NULL : ins_obj->cls->vtable[slot].method;
 		}
 	}
 
-	return found;
+	for (i = 0; i < ins_obj->cls->vtable_size; i++)
+		if (same_method_sig(dex, ins_obj->cls->vtable[i].method_id, method_id))
+			return ins_obj->cls->vtable[i].method;
+
+	return NULL;
+}
+
+encoded_method *find_method_by_name(DexFileFormat *dex, int class_idx, const char *name)
+{
+	class_data_item *item = find_class_data(dex, class_idx);
+	int name_idx = find_string_id(dex, (char *) name);
+	int aggregated_idx = 0;
+	int j;
+
+	if (!item || name_idx < 0)
+		return NULL;
+
+	for (j = 0; j < item->direct_methods_size; j++)
+	{
+		encoded_method *tmp = &item->direct_methods[j];
+		aggregated_idx += tmp->method_idx_diff;
+		if (dex->method_id_item[aggregated_idx].name_idx == name_idx)
+			return tmp;
+	}
+
+	return NULL;
+}
+
+encoded_method *find_method(DexFileFormat *dex, int method_id)
+{
+	return get_encoded_method(dex, method_id);
 }
 
 void simple_dvm_startup(DexFileFormat *dex, simple_dalvik_vm *vm, char *entry)
@@ -3694,8 +4491,10 @@ void simple_dvm_startup(DexFileFormat *dex, simple_dalvik_vm *vm, char *entry)
         printf("no method %s in dex\n", entry);
         return;
     }
+    /* the first method named entry that is defined in this dex */
     for (i = 0 ; i < dex->header.methodIdsSize; i++)
-        if (dex->method_id_item[i].name_idx == method_name_idx) {
+        if (dex->method_id_item[i].name_idx == method_name_idx &&
+            find_method(dex, i)) {
             class_idx = dex->method_id_item[i].class_idx;
             method_idx = i;
             if (is_verbose() > 2) {
@@ -3713,7 +4512,7 @@ void simple_dvm_startup(DexFileFormat *dex, simple_dalvik_vm *vm, char *entry)
 
 //    encoded_method *m =
 //        &dex->class_data_item[class_idx].direct_methods[method_idx];
-    encoded_method *m = find_method(dex, class_idx, method_name_idx);
+    encoded_method *m = find_method(dex, method_idx);
     if (!m)
     {
         printf("No method found\n");
@@ -3722,12 +4521,48 @@ void simple_dvm_startup(DexFileFormat *dex, simple_dalvik_vm *vm, char *entry)
 
     if (is_verbose() > 2)
         printf("encoded_method method_id = %d, insns_size = %d\n",
-               m->method_idx_diff, m->code_item.insns_size);
+               m->method_idx_diff, get_code_item(dex, m)->insns_size);
 
+    init_opCodeTable();
     memset(vm , 0, sizeof(simple_dalvik_vm));
-	hash_init(&vm->root_set);
-    vm->sp = vm->heap + sizeof(vm->heap);
-    vm->fp = vm->sp;
+	hash_init(&vm->root_set, hash_str_eq);
+    heap_init(&vm->heap, get_heap_size(), get_nursery_size());
+    vm->type_class_obj = calloc(dex->header.typeIdsSize, sizeof(class_obj *));
+    if (vm->type_class_obj)
+        vm->type_class_obj_size = dex->header.typeIdsSize;
+    vm->strings = calloc(dex->header.stringIdsSize, sizeof(String *));
+    if (vm->strings)
+        vm->string_count = dex->header.stringIdsSize;
+    vm->frames = malloc(FRAME_STACK_INIT_SIZE * sizeof(vm_frame));
+    vm->reg_stack = malloc(REG_STACK_INIT_SIZE * sizeof(simple_dvm_register));
+    if (!vm->frames || !vm->reg_stack) {
+        printf("cannot allocate VM stack\n");
+        free(vm->frames);
+        free(vm->reg_stack);
+        return;
+    }
+    vm->frame_capacity = FRAME_STACK_INIT_SIZE;
+    vm->reg_stack_size = REG_STACK_INIT_SIZE;
+    vm->regs = vm->reg_stack;
+    if (new_invoke_frame(dex, vm, m, NULL)) {
+        printf("cannot allocate the frame of %s\n", entry);
+        return;
+    }
+
+    runMethod(dex, vm);
+
+    if (is_verbose()) {
+        print_inline_cache_stats(dex);
+        print_class_load_stats(dex);
+        heap_print_stats(&vm->heap);
+    }
 
-    runMethod(dex, vm, m);
+    heap_destroy(&vm->heap);
+    free(vm->strings);
+    vm->strings = NULL;
+    free(vm->frames);
+    free(vm->reg_stack);
+    vm->frames = NULL;
+    vm->reg_stack = NULL;
+    vm->regs = NULL;
 }
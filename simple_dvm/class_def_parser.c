@@ -35,9 +35,7 @@ static void parse_encoded_method(DexFileFormat *dex,
         printf("outs_size = %d\n", method->code_item.outs_size);
         printf("insns_size = %d\n", method->code_item.insns_size);
     }
-    method->code_item.insns = malloc(sizeof(ushort) * method->code_item.insns_size);
-    memcpy(method->code_item.insns, buf + offset,
-           sizeof(ushort) * method->code_item.insns_size);
+    method->code_item.insns = (ushort *) (buf + offset);
     offset += sizeof(ushort) * method->code_item.insns_size;
 }
 
@@ -141,8 +139,8 @@ static void parse_class_data_item(DexFileFormat *dex,
                        dex->class_data_item[index].direct_methods[j].access_flags,
                        dex->class_data_item[index].direct_methods[j].code_off);
 
-            parse_encoded_method(dex, buf,
-                                 &dex->class_data_item[index].direct_methods[j]);
+            memset(&dex->class_data_item[index].direct_methods[j].code_item, 0,
+                   sizeof(code_item));
         }
 
     }
@@ -169,12 +167,45 @@ static void parse_class_data_item(DexFileFormat *dex,
                        dex->class_data_item[index].virtual_methods[j].access_flags,
                        dex->class_data_item[index].virtual_methods[j].code_off);
 
-            parse_encoded_method(dex, buf,
-                                 &dex->class_data_item[index].virtual_methods[j]);
+            memset(&dex->class_data_item[index].virtual_methods[j].code_item, 0,
+                   sizeof(code_item));
         }
     }
 }
 
+static void index_encoded_methods(DexFileFormat *dex,
+                                  encoded_method *methods, int size)
+{
+    int i = 0;
+    int method_id = 0;
+
+    for (i = 0; i < size; i++) {
+        method_id += methods[i].method_idx_diff;
+        if (method_id < dex->header.methodIdsSize)
+            dex->method_index[method_id] = &methods[i];
+    }
+}
+
+/*
+ * Index class_defs by type_idx, so class lookups don't scan every
+ * class_def.  method_index is filled as class_data_items are loaded.
+ */
+static void build_class_def_index(DexFileFormat *dex)
+{
+    int i = 0;
+
+    dex->class_def_index = malloc(sizeof(int) * dex->header.typeIdsSize);
+    dex->method_index = calloc(dex->header.methodIdsSize, sizeof(encoded_method *));
+
+    for (i = 0 ; i < dex->header.typeIdsSize; i++)
+        dex->class_def_index[i] = -1;
+
+    for (i = 0 ; i < dex->header.classDefsSize; i++) {
+        if (dex->class_def_item[i].class_idx < dex->header.typeIdsSize)
+            dex->class_def_index[dex->class_def_item[i].class_idx] = i;
+    }
+}
+
 void parse_class_defs(DexFileFormat *dex, unsigned char *buf, int offset)
 {
     int i = 0;
@@ -182,15 +213,12 @@ void parse_class_defs(DexFileFormat *dex, unsigned char *buf, int offset)
         printf("parse class defs offset = %04x\n", offset + sizeof(DexHeader));
     if (dex->header.classDefsSize <= 0)
         return;
-    dex->class_def_item = malloc(
-                              sizeof(class_def_item) * dex->header.classDefsSize);
-    dex->class_data_item = malloc(
-                               sizeof(class_data_item) * dex->header.classDefsSize);
+    dex->class_def_item = (class_def_item *) (buf + offset);
+    /* class_data_items are parsed on first use, see get_class_data_item() */
+    dex->class_data_item = calloc(dex->header.classDefsSize,
+                                  sizeof(class_data_item));
 
     for (i = 0 ; i < dex->header.classDefsSize; i++) {
-        memcpy(&dex->class_def_item[i],
-               buf + i * sizeof(class_def_item) + offset,
-               sizeof(class_def_item));
         if (is_verbose() > 3) {
             printf(" class_defs[%d], cls_id = %d, data_off = 0x%04x, source_file_idx = %d\n",
                    i,
@@ -198,7 +226,62 @@ void parse_class_defs(DexFileFormat *dex, unsigned char *buf, int offset)
                    dex->class_def_item[i].class_data_off,
                    dex->class_def_item[i].source_file_idx);
         }
-        parse_class_data_item(dex, buf,
-                              dex->class_def_item[i].class_data_off - sizeof(DexHeader), i);
     }
+    build_class_def_index(dex);
+}
+
+class_data_item *get_class_data_item(DexFileFormat *dex, int index)
+{
+    class_data_item *item = 0;
+
+    if (index < 0 || index >= dex->header.classDefsSize)
+        return 0;
+
+    item = &dex->class_data_item[index];
+    if (!item->loaded) {
+        if (dex->class_def_item[index].class_data_off)
+            parse_class_data_item(dex, dex->image + sizeof(DexHeader),
+                                  dex->class_def_item[index].class_data_off - sizeof(DexHeader),
+                                  index);
+        index_encoded_methods(dex, item->direct_methods, item->direct_methods_size);
+        index_encoded_methods(dex, item->virtual_methods, item->virtual_methods_size);
+        item->loaded = 1;
+        dex->class_data_loaded++;
+    }
+    return item;
+}
+
+code_item *get_code_item(DexFileFormat *dex, encoded_method *method)
+{
+    if (!method->code_item.insns && method->code_off) {
+        parse_encoded_method(dex, dex->image + sizeof(DexHeader), method);
+        dex->code_items_loaded++;
+    }
+    return &method->code_item;
+}
+
+void print_class_load_stats(DexFileFormat *dex)
+{
+    printf("class_data_items loaded: %d/%d, code_items loaded: %d\n",
+           dex->class_data_loaded, dex->header.classDefsSize,
+           dex->code_items_loaded);
+}
+
+int get_class_def_index(DexFileFormat *dex, int type_id)
+{
+    if (dex->class_def_index && type_id >= 0 && type_id < dex->header.typeIdsSize)
+        return dex->class_def_index[type_id];
+    return -1;
+}
+
+encoded_method *get_encoded_method(DexFileFormat *dex, int method_id)
+{
+    if (!dex->method_index || method_id < 0 || method_id >= dex->header.methodIdsSize)
+        return 0;
+
+    /* the defining class may not have been loaded yet */
+    if (!dex->method_index[method_id])
+        get_class_data_item(dex, get_class_def_index(dex,
+                            dex->method_id_item[method_id].class_idx));
+    return dex->method_index[method_id];
 }
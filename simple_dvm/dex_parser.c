@@ -4,6 +4,10 @@
  * Copyright (C) 2013 Chun-Yu Wang <wicanr2@gmail.com>
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "simple_dvm.h"
 
 /* Print Dex File Format */
@@ -53,25 +57,72 @@ void printDexFile(DexFileFormat *dex)
     printDexHeader(&dex->header);
 }
 
+/*
+ * Load the whole dex file into dex->image.  The file is mmap()ed when
+ * possible, so the pages are shared through the page cache, otherwise it
+ * is read into a malloc()ed buffer.  Either way the image stays alive
+ * until freeDex(), since the parsed tables point into it.
+ */
+static int load_dex_image(char *file, DexFileFormat *dex)
+{
+    struct stat st;
+    int fd = 0;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        printf("Open file %s failed\n", file);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(DexHeader)) {
+        printf("Invalid dex file %s\n", file);
+        close(fd);
+        return -1;
+    }
+    dex->image_size = st.st_size;
+
+    dex->image = mmap(NULL, dex->image_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (dex->image != MAP_FAILED) {
+        dex->image_mapped = 1;
+    } else {
+        int len = 0;
+
+        dex->image = malloc(dex->image_size);
+        dex->image_mapped = 0;
+        while (dex->image && len < dex->image_size) {
+            int n = read(fd, dex->image + len, dex->image_size - len);
+            if (n <= 0)
+                break;
+            len += n;
+        }
+        if (!dex->image || len < dex->image_size) {
+            printf("Read file %s failed\n", file);
+            free(dex->image);
+            dex->image = NULL;
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    if (is_verbose() > 3)
+        printf("dex image %s: %d bytes, %s\n", file, dex->image_size,
+               dex->image_mapped ? "mapped" : "copied");
+    return 0;
+}
+
 /* Parse Dex File */
 int parseDexFile(char *file, DexFileFormat *dex)
 {
-    FILE *fp = 0;
     unsigned char *buf = 0;
 
-    fp = fopen(file, "rb");
-    if (fp == 0) {
-        printf("Open file %s failed\n", file);
+    if (load_dex_image(file, dex) < 0)
+        return -1;
+    memcpy(&dex->header, dex->image, sizeof(DexHeader));
+    if (dex->header.fileSize > dex->image_size) {
+        printf("Truncated dex file %s\n", file);
         return -1;
     }
-    memset(dex, 0, sizeof(dex));
-    fread(&dex->header, sizeof(DexHeader), 1, fp);
-    buf = (unsigned char *) malloc(
-              sizeof(u1) * (dex->header.fileSize - sizeof(DexHeader)));
-
-    /* read all value into buf */
-    fread(buf, (dex->header.fileSize - sizeof(DexHeader)), 1, fp);
-    fclose(fp);
+    buf = dex->image + sizeof(DexHeader);
 
     parse_map_list(dex, buf, dex->header.mapOff - sizeof(DexHeader));
     parse_string_ids(dex, buf, dex->header.stringIdsOff - sizeof(DexHeader));
@@ -81,72 +132,43 @@ int parseDexFile(char *file, DexFileFormat *dex)
     parse_method_ids(dex, buf, dex->header.methodIdsOff - sizeof(DexHeader));
     parse_class_defs(dex, buf, dex->header.classDefsOff - sizeof(DexHeader));
 
-    if (dex->header.dataSize > 0) {
-        dex->data = malloc(sizeof(u1) * dex->header.dataSize);
-        memcpy(dex->data, buf, dex->header.dataOff - sizeof(DexHeader));
-    }
+    if (dex->header.dataSize > 0)
+        dex->data = dex->image + dex->header.dataOff;
 
-    free(buf);
     return 0;
 }
 
-void free_map_list(DexFileFormat *dex)
-{
-	if (dex->type_list.type_item)
-		free(dex->type_list.type_item);
-
-	if (dex->map_list.map_item)
-		free(dex->map_list.map_item);
-}
-
 void free_string_ids(DexFileFormat *dex)
 {
 	if (dex->string_data_item)
 		free(dex->string_data_item);
 
-	if (dex->string_ids)
-		free(dex->string_ids);
+	hash_free(&dex->string_index);
 }
 
-void free_type_ids(DexFileFormat *dex)
+void free_proto_ids(DexFileFormat *dex)
 {
-	if (dex->type_id_item)
-		free(dex->type_id_item);
+	if (dex->proto_type_list)
+		free(dex->proto_type_list);
 }
 
-void free_proto_ids(DexFileFormat *dex)
+void free_encoded_method(encoded_method *method)
 {
 	int i;
 
-	if (dex->proto_id_item)
-		free(dex->proto_id_item);
+	if (method->code_item.decoded) {
+		for (i = 0; i < method->code_item.decoded_size; i++) {
+			decoded_insn *insn = &method->code_item.decoded[i];
 
-	if (dex->proto_type_list) {
-		for (i = 0; i < dex->header.protoIdsSize; i++) {
-			if (dex->proto_type_list[i].type_item)
-				free(dex->proto_type_list[i].type_item);
+			/* only invoke-virtual owns its data (an inline_cache) */
+			if (insn->opcode == 0x6e && insn->data)
+				free(insn->data);
 		}
-
-		free(dex->proto_type_list);
+		free(method->code_item.decoded);
 	}
-}
-
-void free_field_ids(DexFileFormat *dex)
-{
-	if (dex->field_id_item)
-		free(dex->field_id_item);
-}
-
-void free_method_ids(DexFileFormat *dex)
-{
-	if (dex->method_id_item)
-		free(dex->method_id_item);
-}
 
-void free_encoded_method(encoded_method *method)
-{
-	if (method->code_item.insns)
-		free(method->code_item.insns);
+	if (method->code_item.decoded_index)
+		free(method->code_item.decoded_index);
 }
 
 void free_class_data_item(DexFileFormat *dex, int idx)
@@ -167,9 +189,6 @@ void free_class_defs(DexFileFormat *dex)
 {
 	int i;
 
-	if (dex->class_def_item)
-		free(dex->class_def_item);
-
 	if (dex->class_data_item) {
 		for (i = 0; i < dex->header.classDefsSize; i++) {
 			free_class_data_item(dex, i);
@@ -177,15 +196,25 @@ void free_class_defs(DexFileFormat *dex)
 
 		free(dex->class_data_item);
 	}
+
+	if (dex->class_def_index)
+		free(dex->class_def_index);
+
+	if (dex->method_index)
+		free(dex->method_index);
 }
 
 void freeDex(DexFileFormat *dex)
 {
-	free_map_list(dex);
 	free_string_ids(dex);
-	free_type_ids(dex);
 	free_proto_ids(dex);
-	free_field_ids(dex);
-	free_method_ids(dex);
 	free_class_defs(dex);
+
+	if (dex->image) {
+		if (dex->image_mapped)
+			munmap(dex->image, dex->image_size);
+		else
+			free(dex->image);
+		dex->image = NULL;
+	}
 }
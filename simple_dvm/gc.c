@@ -0,0 +1,239 @@
+/*
+ * Simple Dalvik Virtual Machine Implementation
+ *
+ * Generational garbage collector: a copying minor collection of the
+ * nursery and a stop-the-world mark-sweep full collection
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <time.h>
+#include "java_lib.h"
+
+/* State of the running minor collection */
+static int tenure_age;
+static unsigned int young_refs;	/* references to the nursery visited */
+
+/* Only the slots of fields declared with a reference type in data, the
+ * field data they describe, can hold an object */
+void gc_visit_fields(vm_heap *heap, field_info *fields, int size, u1 *data, gc_slot_func visit)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		if (fields[i].type[0] == 'L' || fields[i].type[0] == '[')
+			visit(heap, (void **) (data + fields[i].offset));
+}
+
+static void visit_object(vm_heap *heap, void *obj, gc_slot_func visit)
+{
+	obj_header *header = obj_header_of(obj);
+	instance_obj *ins_obj;
+	array_obj *arr_obj;
+	int i;
+
+	switch (header->kind) {
+	case OBJ_INSTANCE:
+		ins_obj = (instance_obj *) obj;
+		gc_visit_fields(heap, ins_obj->cls->ifields, ins_obj->cls->ifield_size,
+				instance_data(ins_obj), visit);
+		/* the array_obj or StringBuilder of arrays and library objects */
+		visit(heap, &ins_obj->priv_data);
+		break;
+	case OBJ_ARRAY:
+		arr_obj = (array_obj *) obj;
+		if (!array_holds_refs(arr_obj))
+			break;
+		for (i = 0; i < arr_obj->size; i++)
+			visit(heap, &array_refs(arr_obj)[i]);
+		break;
+	case OBJ_STRING_BUILDER:
+		visit(heap, (void **) &((StringBuilder *) obj)->str);
+		break;
+	default:
+		/* Strings and Longs keep their data inline */
+		break;
+	}
+}
+
+static void visit_statics(simple_dalvik_vm *vm, gc_slot_func visit)
+{
+	uint i;
+
+	for (i = 0; i < vm->root_set.capacity; i++)
+	{
+		class_obj *cls = vm->root_set.entries[i].value;
+
+		if (vm->root_set.entries[i].hash)
+			gc_visit_fields(&vm->heap, cls->fields, cls->field_size, cls->statics, visit);
+	}
+	java_lib_visit_roots(vm, visit);
+}
+
+/* Strings point into themselves; a copy must follow suit */
+static void relocate(void *from, void *to)
+{
+	obj_header *header = obj_header_of(to);
+
+	if (header->kind == OBJ_STRING) {
+		String *s = to;
+
+		if (s->buf == (char *) from + sizeof(String))
+			s->buf = (char *) to + sizeof(String);
+	}
+}
+
+/*
+ * Minor collection visitor: move the young object *slot refers to out of
+ * the from-space, unless its block is pinned, and update the slot.  An
+ * object copied before its block had to be kept is still forwarded.
+ */
+static void forward_slot(vm_heap *heap, void **slot)
+{
+	void *obj = *slot;
+	nursery_block *block;
+
+	if (!heap_is_young(heap, obj) || !heap_is_object(heap, obj))
+		return;
+	block = heap_block_of(heap, obj);
+	if (block->state & BLOCK_FROM) {
+		if (obj_header_of(obj)->flags & OBJ_FORWARDED) {
+			obj = *(void **) obj;
+		} else if (!(block->state & BLOCK_PINNED)) {
+			void *copy = heap_copy_young(heap, obj, tenure_age);
+
+			if (copy != obj)
+				relocate(obj, copy);
+			obj = copy;
+		}
+		*slot = obj;
+	}
+	if (heap_is_young(heap, obj))
+		young_refs++;
+}
+
+/* Trace an object reached by the minor collection.  An old one that
+ * still refers to the nursery gets its card dirtied. */
+static void forward_object(vm_heap *heap, void *obj)
+{
+	young_refs = 0;
+	visit_object(heap, obj, forward_slot);
+	if (young_refs && !heap_is_young(heap, obj))
+		heap_card_mark(obj);
+}
+
+static double elapsed_ms(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000.0 +
+		(end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/*
+ * Copy the live young objects out of the blocks allocated since the last
+ * minor collection.  The roots are the registers, the static fields when
+ * one may refer to the nursery, and the old objects on dirty cards.
+ * Registers are untyped and cannot be updated, so a block holding an
+ * object a register refers to is pinned and kept whole instead.  Returns
+ * -1 if a survivor could not be copied for want of memory.
+ */
+static int gc_minor(simple_dalvik_vm *vm, int tenure)
+{
+	vm_heap *heap = &vm->heap;
+	unsigned int before = heap_young_bytes(heap);
+	unsigned int promoted = heap->promoted;
+	struct timespec start;
+	void *obj;
+	uint i;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tenure_age = tenure;
+	heap_begin_minor(heap);
+
+	for (i = 0; i < vm->reg_top; i++)
+		heap_pin(heap, (void *) (unsigned long) vm->reg_stack[i]);
+	heap_pin(heap, (void *) (unsigned long) vm->result[0]);
+	heap_keep_pinned(heap);
+
+	if (heap->statics_dirty) {
+		young_refs = 0;
+		visit_statics(vm, forward_slot);
+		heap->statics_dirty = young_refs != 0;
+	}
+	heap_scan_cards(heap, forward_object);
+
+	while ((obj = heap_next_gray(heap)))
+		forward_object(heap, obj);
+	ret = heap_end_minor(heap);
+
+	if (is_gc_verbose() || is_verbose())
+		printf("[GC (minor) #%u %uK->%uK, promoted %u bytes, %.3f ms]\n",
+				heap->minor_collections, before / 1024,
+				heap_young_bytes(heap) / 1024, heap->promoted - promoted,
+				elapsed_ms(&start));
+	return ret;
+}
+
+static void mark_slot(vm_heap *heap, void **slot)
+{
+	heap_mark(heap, *slot);
+}
+
+static void mark_object(vm_heap *heap, void *obj)
+{
+	visit_object(heap, obj, mark_slot);
+}
+
+/*
+ * Collect the whole heap: empty the nursery into the old generation,
+ * then mark from the roots and sweep.  What a register keeps in the
+ * nursery stays there and is traced as a root.  Returns -1 if the
+ * objects still alive afterwards exceed the heap limit.
+ */
+static int gc_full(simple_dalvik_vm *vm)
+{
+	vm_heap *heap = &vm->heap;
+	unsigned int before;
+	heap_gc_stats stats;
+	struct timespec start;
+	void *obj;
+	uint i;
+
+	if (gc_minor(vm, 0))
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	before = heap->used;
+	for (i = 0; i < vm->reg_top; i++)
+		heap_mark(heap, (void *) (unsigned long) vm->reg_stack[i]);
+	heap_mark(heap, (void *) (unsigned long) vm->result[0]);
+	visit_statics(vm, mark_slot);
+	heap_walk_young(heap, mark_object);
+
+	while ((obj = heap_next_gray(heap)))
+		mark_object(heap, obj);
+	heap_sweep(heap, &stats);
+
+	if (is_gc_verbose() || is_verbose())
+		printf("[GC (full) #%u %uK->%uK(%uK), freed %u objects, %u bytes, %.3f ms]\n",
+				heap->collections, before / 1024, stats.live / 1024,
+				heap->limit / 1024, stats.objects, stats.bytes,
+				elapsed_ms(&start));
+
+	return stats.live > heap->limit ? -1 : 0;
+}
+
+/*
+ * Run the collection the heap asked for.  Must only be called between
+ * instructions, when no handler has an object in its locals.  Returns -1
+ * if the heap is out of memory.
+ */
+int gc_collect(simple_dalvik_vm *vm)
+{
+	if (vm->heap.gc_pending & GC_FULL)
+		return gc_full(vm);
+	return gc_minor(vm, TENURE_AGE);
+}
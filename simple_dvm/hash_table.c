@@ -1,15 +1,25 @@
 #include <stdio.h>
-#include "list_head.h"
+#include <stdlib.h>
+#include <string.h>
 #include "hash_table.h"
 
-void hash_init(struct hash_table *table)
+/* 0 marks an empty slot */
+#define HASH_FIX(h) ((h) ? (h) : 1)
+/* how far the entry with hash h sits from its home slot */
+#define PROBE_DIST(table, h, slot) (((slot) - (h)) & ((table)->capacity - 1))
+
+void hash_init(struct hash_table *table, hash_eq_func eq)
 {
-	int i;
+	table->entries = NULL;
+	table->capacity = 0;
+	table->size = 0;
+	table->eq = eq;
+}
 
-	for (i = 0; i < HASH_SIZE; i++)
-	{
-		list_init(&table->entries[i]);
-	} 
+void hash_free(struct hash_table *table)
+{
+	free(table->entries);
+	hash_init(table, table->eq);
 }
 
 unsigned int hash(char *str)
@@ -23,15 +33,134 @@ unsigned int hash(char *str)
 	return hash;
 }
 
-void hash_add(struct hash_table *table, struct list_head *node, unsigned int key)
+int hash_str_eq(const void *key1, const void *key2)
 {
-	list_add_head(node, &table->entries[key % HASH_SIZE]); 
+	return strcmp((const char *) key1, (const char *) key2) == 0;
+}
+
+int hash_ptr_eq(const void *key1, const void *key2)
+{
+	return key1 == key2;
+}
+
+/* Insert an entry known not to be in the table */
+static void hash_insert(struct hash_table *table, struct hash_entry entry)
+{
+	unsigned int mask = table->capacity - 1;
+	unsigned int slot = entry.hash & mask;
+	unsigned int dist = 0;
+
+	while (table->entries[slot].hash)
+	{
+		struct hash_entry *cur = &table->entries[slot];
+		unsigned int cur_dist = PROBE_DIST(table, cur->hash, slot);
+
+		/* robin-hood: the entry further from home keeps the slot */
+		if (cur_dist < dist)
+		{
+			struct hash_entry tmp = *cur;
+
+			*cur = entry;
+			entry = tmp;
+			dist = cur_dist;
+		}
+		slot = (slot + 1) & mask;
+		dist++;
+	}
+	table->entries[slot] = entry;
+	table->size++;
+}
+
+static int hash_resize(struct hash_table *table, unsigned int capacity)
+{
+	struct hash_entry *old = table->entries;
+	unsigned int old_capacity = table->capacity;
+	unsigned int i;
+
+	table->entries = calloc(capacity, sizeof(struct hash_entry));
+	if (!table->entries)
+	{
+		table->entries = old;
+		return -1;
+	}
+	table->capacity = capacity;
+	table->size = 0;
+
+	for (i = 0; i < old_capacity; i++)
+		if (old[i].hash)
+			hash_insert(table, old[i]);
+	free(old);
+
+	return 0;
 }
 
-struct list_head *hash_get(struct hash_table *table, unsigned int key)
+static struct hash_entry *hash_find(struct hash_table *table, unsigned int key_hash, const void *key)
 {
-	if (list_empty(&table->entries[key % HASH_SIZE]))
+	unsigned int mask = table->capacity - 1;
+	unsigned int slot, dist = 0;
+
+	if (!table->capacity)
+		return NULL;
+
+	key_hash = HASH_FIX(key_hash);
+	slot = key_hash & mask;
+	while (table->entries[slot].hash)
+	{
+		struct hash_entry *cur = &table->entries[slot];
+
+		/* every entry past here would have displaced the key */
+		if (PROBE_DIST(table, cur->hash, slot) < dist)
 			return NULL;
-	return &table->entries[key % HASH_SIZE];
+		if (cur->hash == key_hash && table->eq(cur->key, key))
+			return cur;
+		slot = (slot + 1) & mask;
+		dist++;
+	}
+
+	return NULL;
 }
 
+/* Add key, or replace the value of an existing key; grows at 3/4 load */
+int hash_put(struct hash_table *table, unsigned int key_hash, const void *key, void *value)
+{
+	struct hash_entry *found = hash_find(table, key_hash, key);
+	struct hash_entry entry;
+
+	if (found)
+	{
+		found->value = value;
+		return 0;
+	}
+
+	if ((table->size + 1) * 4 > table->capacity * 3)
+	{
+		if (hash_resize(table, table->capacity ? table->capacity * 2 : HASH_INIT_SIZE))
+			return -1;
+	}
+
+	entry.hash = HASH_FIX(key_hash);
+	entry.key = key;
+	entry.value = value;
+	hash_insert(table, entry);
+
+	return 0;
+}
+
+int hash_lookup(struct hash_table *table, unsigned int key_hash, const void *key, void **value)
+{
+	struct hash_entry *found = hash_find(table, key_hash, key);
+
+	if (!found)
+		return 0;
+	if (value)
+		*value = found->value;
+	return 1;
+}
+
+void *hash_get(struct hash_table *table, unsigned int key_hash, const void *key)
+{
+	void *value = NULL;
+
+	hash_lookup(table, key_hash, key, &value);
+	return value;
+}
@@ -1,18 +1,39 @@
 #ifndef _HASHTABLE_H_
 #define _HASHTABLE_H_
 
-#include "list_head.h"
+/*
+ * Growable open-addressing hash table with robin-hood probing.
+ *
+ * Each slot keeps the full hash of its key, so probing only calls the
+ * key compare function on a hash match.  A hash of 0 marks an empty slot.
+ */
 
-#define HASH_SIZE 128
+#define HASH_INIT_SIZE 16
+
+typedef int (*hash_eq_func)(const void *key1, const void *key2);
+
+struct hash_entry
+{
+	unsigned int hash;
+	const void *key;
+	void *value;
+};
 
 struct hash_table
 {
-	struct list_head entries[HASH_SIZE];
+	struct hash_entry *entries;
+	unsigned int capacity; /* power of two */
+	unsigned int size;
+	hash_eq_func eq;
 };
 
-void hash_init(struct hash_table *table);
+void hash_init(struct hash_table *table, hash_eq_func eq);
+void hash_free(struct hash_table *table);
 unsigned int hash(char *ptr);
-void hash_add(struct hash_table *table, struct list_head *node, unsigned int key);
-struct list_head *hash_get(struct hash_table *table, unsigned int key);
+int hash_str_eq(const void *key1, const void *key2);
+int hash_ptr_eq(const void *key1, const void *key2);
+int hash_put(struct hash_table *table, unsigned int key_hash, const void *key, void *value);
+int hash_lookup(struct hash_table *table, unsigned int key_hash, const void *key, void **value);
+void *hash_get(struct hash_table *table, unsigned int key_hash, const void *key);
 
 #endif // _HASHTABLE_H_
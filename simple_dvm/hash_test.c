@@ -1,51 +1,80 @@
 #include <stdio.h>
-#include "list_head.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "hash_table.h"
 
-struct test
+/*
+ * Micro-benchmark of hash_table: inserts N class-name-like keys, then
+ * times successful and failed lookups.
+ *
+ * usage: hash_test [N] [rounds]
+ */
+
+static double now(void)
 {
-	struct list_head entry;
-	char data[128];
-};
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return tp.tv_sec + tp.tv_nsec / 1e9;
+}
 
-int main()
+int main(int argc, char *argv[])
 {
-	int i;
+	int n = (argc > 1) ? atoi(argv[1]) : 10000;
+	int rounds = (argc > 2) ? atoi(argv[2]) : 100;
 	struct hash_table table;
-	struct list_head *e;
-	struct test array[10];
+	char (*keys)[32];
+	char miss[32];
+	double start, t_put, t_hit, t_miss;
+	long found = 0;
+	int i, r;
 
-	hash_init(&table);
+	keys = malloc(sizeof(*keys) * n);
+	if (!keys)
+		return 1;
+	for (i = 0; i < n; i++)
+		sprintf(keys[i], "Lcom/example/Class%d;", i);
 
-	for (i = 0; i < 10; i++)
+	hash_init(&table, hash_str_eq);
+	start = now();
+	for (i = 0; i < n; i++)
+		hash_put(&table, hash(keys[i]), keys[i], keys[i]);
+	t_put = now() - start;
+
+	for (i = 0; i < n; i++)
 	{
-		list_init(&array[i].entry);
-		sprintf(array[i].data, "%d", i);
+		if (hash_get(&table, hash(keys[i]), keys[i]) != keys[i])
+		{
+			printf("lookup of %s failed\n", keys[i]);
+			return 1;
+		}
 	}
 
-	hash_add(&table, &array[0].entry, hash(array[0].data));
-	hash_add(&table, &array[3].entry, hash(array[3].data));
-	hash_add(&table, &array[4].entry, hash(array[4].data));
-	hash_add(&table, &array[5].entry, hash(array[5].data));
-	hash_add(&table, &array[7].entry, hash(array[7].data));
-	hash_add(&table, &array[9].entry, hash(array[9].data));
+	start = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < n; i++)
+			found += hash_get(&table, hash(keys[i]), keys[i]) != NULL;
+	t_hit = now() - start;
 
-	for (i = 0; i < 10; i++)
+	start = now();
+	for (r = 0; r < rounds; r++)
 	{
-		char str[32];
-		struct test *tmp;
-
-		sprintf(str, "%d", i);
-		e = hash_get(&table, hash(str));
-		if (!e)
+		for (i = 0; i < n; i++)
 		{
-			printf("%d: null\n", i);
-			continue;
+			sprintf(miss, "Lcom/example/Missing%d;", i);
+			found += hash_get(&table, hash(miss), miss) != NULL;
 		}
-
-		tmp = container_of(e, struct test, entry);
-		printf("%d: %s\n", i, tmp->data);
 	}
+	t_miss = now() - start;
+
+	printf("%d keys, capacity %u, %d rounds\n", n, table.capacity, rounds);
+	printf("put:  %8.1f ns/op\n", t_put * 1e9 / n);
+	printf("hit:  %8.1f ns/op\n", t_hit * 1e9 / ((double) n * rounds));
+	printf("miss: %8.1f ns/op (includes sprintf)\n", t_miss * 1e9 / ((double) n * rounds));
+	printf("found %ld\n", found);
 
+	hash_free(&table);
+	free(keys);
 	return 0;
 }
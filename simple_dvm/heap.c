@@ -0,0 +1,792 @@
+/*
+ * Simple Dalvik Virtual Machine Implementation
+ *
+ * VM-owned object heap
+ */
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heap.h"
+
+#define ALIGN_UP(n) (((n) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1))
+
+/* class statistics are keyed by the descriptor pointer, which is unique
+ * per class, so counting an allocation does not hash the name */
+#define TYPE_HASH(type) ((unsigned int) (unsigned long) (type) * 2654435761u)
+
+/* block boundary bitmaps of chunks and nursery blocks */
+#define START_BIT(base, p) ((unsigned int) ((char *) (p) - (base)) / HEAP_ALIGN)
+
+static inline void set_start(unsigned char *map, char *base, void *p)
+{
+	unsigned int bit = START_BIT(base, p);
+
+	map[bit >> 3] |= 1 << (bit & 7);
+}
+
+static inline void clear_start(unsigned char *map, char *base, void *p)
+{
+	unsigned int bit = START_BIT(base, p);
+
+	map[bit >> 3] &= ~(1 << (bit & 7));
+}
+
+static inline int test_start(unsigned char *map, char *base, void *p)
+{
+	unsigned int bit = START_BIT(base, p);
+
+	return map[bit >> 3] & (1 << (bit & 7));
+}
+
+/* Whether a block of chunk starts at p.  The bitmap of a large object's
+ * chunk covers its header only; the rest of it is the object's payload. */
+static inline int chunk_test_start(heap_chunk *chunk, void *p)
+{
+	return (unsigned int) ((char *) p - chunk->start) < chunk->map_size &&
+		test_start(chunk->starts, chunk->start, p);
+}
+
+static void init_nursery(vm_heap *heap, unsigned int size)
+{
+	unsigned int count = size / NURSERY_BLOCK_SIZE;
+	unsigned int i;
+
+	if (count < 2)
+		count = 2;
+	heap->nursery = malloc(count * NURSERY_BLOCK_SIZE);
+	heap->blocks = calloc(count, sizeof(nursery_block));
+	if (!heap->nursery || !heap->blocks) {
+		/* everything is allocated old then */
+		printf("cannot allocate a nursery of %u bytes\n", count * NURSERY_BLOCK_SIZE);
+		free(heap->nursery);
+		free(heap->blocks);
+		heap->nursery = NULL;
+		heap->blocks = NULL;
+		return;
+	}
+	heap->nursery_end = heap->nursery + count * NURSERY_BLOCK_SIZE;
+	heap->block_count = count;
+	heap->young_limit = count / 2;
+	for (i = count; i-- > 0;) {
+		nursery_block *block = &heap->blocks[i];
+
+		block->start = heap->nursery + i * NURSERY_BLOCK_SIZE;
+		block->top = block->start;
+		block->next = heap->free_blocks;
+		heap->free_blocks = block;
+	}
+}
+
+/* Empty the heap's bookkeeping; allocates nothing */
+static void reset_heap(vm_heap *heap, unsigned int limit)
+{
+	memset(heap, 0, sizeof(vm_heap));
+	hash_init(&heap->class_stats, hash_ptr_eq);
+	heap->limit = limit;
+	heap->next_gc = limit < GC_MIN_TRIGGER ? limit : GC_MIN_TRIGGER;
+}
+
+void heap_init(vm_heap *heap, unsigned int limit, unsigned int nursery_size)
+{
+	reset_heap(heap, limit);
+	init_nursery(heap, nursery_size);
+}
+
+void heap_destroy(vm_heap *heap)
+{
+	heap_chunk *chunk = heap->chunks;
+	unsigned int i;
+
+	while (chunk) {
+		heap_chunk *next = chunk->next;
+
+		free(chunk);
+		chunk = next;
+	}
+	while (heap->permanent) {
+		void *next = *(void **) heap->permanent;
+
+		free(heap->permanent);
+		heap->permanent = next;
+	}
+	for (i = 0; i < heap->class_stats.capacity; i++)
+		if (heap->class_stats.entries[i].hash)
+			free(heap->class_stats.entries[i].value);
+	hash_free(&heap->class_stats);
+	free(heap->mark_stack);
+	free(heap->nursery);
+	free(heap->blocks);
+	reset_heap(heap, heap->limit);
+}
+
+/*
+ * A chunk with room for size bytes of objects, of which the first
+ * map_size bytes are covered by the start bitmap and the cards: all of a
+ * chunk that is bumped into, just the header of a large object.
+ */
+static heap_chunk *new_chunk(unsigned int size, unsigned int map_size)
+{
+	unsigned int map = (map_size / HEAP_ALIGN + 7) / 8;
+	unsigned int cards = (map_size >> CARD_SHIFT) + 1;
+	unsigned int overhead = ALIGN_UP(sizeof(heap_chunk)) + ALIGN_UP(map) + ALIGN_UP(cards);
+	heap_chunk *chunk;
+	void *mem;
+
+	if (posix_memalign(&mem, HEAP_CHUNK_SIZE, overhead + size))
+		return NULL;
+	chunk = mem;
+	chunk->next = NULL;
+	chunk->starts = (unsigned char *) chunk + ALIGN_UP(sizeof(heap_chunk));
+	memset(chunk->starts, 0, map);
+	chunk->map_size = map_size;
+	chunk->cards = chunk->starts + ALIGN_UP(map);
+	memset(chunk->cards, 0, cards);
+	chunk->card_count = cards;
+	chunk->start = (char *) chunk->cards + ALIGN_UP(cards);
+	chunk->top = chunk->start;
+	chunk->end = chunk->start + size;
+	return chunk;
+}
+
+/* A chunk to bump-allocate from, HEAP_CHUNK_SIZE bytes in all */
+static heap_chunk *new_bump_chunk(void)
+{
+	unsigned int overhead = ALIGN_UP(sizeof(heap_chunk)) +
+		ALIGN_UP(HEAP_CHUNK_SIZE / HEAP_ALIGN / 8) +
+		ALIGN_UP((HEAP_CHUNK_SIZE >> CARD_SHIFT) + 1);
+
+	return new_chunk(HEAP_CHUNK_SIZE - overhead, HEAP_CHUNK_SIZE - overhead);
+}
+
+static void count_alloc(vm_heap *heap, const char *type, unsigned int bytes)
+{
+	heap_class_stats *stats;
+
+	heap->objects++;
+	heap->bytes += bytes;
+	if (!type)
+		return;
+	stats = hash_get(&heap->class_stats, TYPE_HASH(type), type);
+	if (!stats) {
+		stats = calloc(1, sizeof(heap_class_stats));
+		if (!stats)
+			return;
+		stats->type = type;
+		hash_put(&heap->class_stats, TYPE_HASH(type), type, stats);
+	}
+	stats->objects++;
+	stats->bytes += bytes;
+}
+
+static void *init_object(vm_heap *heap, obj_header *header, unsigned int size,
+		int kind, const char *type)
+{
+	unsigned int bytes = OBJ_HEADER_SIZE + size;
+
+	memset(header, 0, bytes);
+	header->size = size;
+	header->kind = kind;
+	header->type = type;
+	count_alloc(heap, type, bytes);
+
+	return (char *) header + OBJ_HEADER_SIZE;
+}
+
+static void free_list_add(vm_heap *heap, free_block *block)
+{
+	unsigned int bytes = OBJ_HEADER_SIZE + block->size;
+
+	if (bytes <= FREE_SMALL_MAX) {
+		block->next = heap->free_small[bytes / HEAP_ALIGN];
+		heap->free_small[bytes / HEAP_ALIGN] = block;
+	} else {
+		block->next = heap->free_large;
+		heap->free_large = block;
+	}
+}
+
+/*
+ * First fit on the list of large free blocks.  What is left of the block
+ * is split off as a free block of its own unless it is too small to hold
+ * anything, in which case the object gets the whole block.
+ */
+static obj_header *take_free_block(vm_heap *heap, unsigned int bytes)
+{
+	free_block **link = &heap->free_large;
+	free_block *block;
+
+	for (; (block = *link); link = &block->next) {
+		unsigned int avail = OBJ_HEADER_SIZE + block->size;
+
+		if (avail < bytes)
+			continue;
+		*link = block->next;
+		if (avail - bytes >= OBJ_HEADER_SIZE + HEAP_ALIGN) {
+			free_block *rest = (free_block *) ((char *) block + bytes);
+
+			rest->size = avail - bytes - OBJ_HEADER_SIZE;
+			rest->kind = OBJ_FREE;
+			rest->flags = 0;
+			rest->chunk = block->chunk;
+			set_start(block->chunk->starts, block->chunk->start, rest);
+			free_list_add(heap, rest);
+			block->size = bytes - OBJ_HEADER_SIZE;
+		}
+		return (obj_header *) block;
+	}
+	return NULL;
+}
+
+/*
+ * Room for an old object of bytes bytes, header included; the header
+ * returned holds the payload size of what was found.  A free block of the
+ * exact size is reused first, then objects are bumped out of the current
+ * chunk; one that would waste more than a quarter of a chunk gets a chunk
+ * of its own, linked behind the current one so allocation carries on
+ * where it was.  Crossing next_gc requests a full collection.
+ */
+static obj_header *alloc_old(vm_heap *heap, unsigned int bytes)
+{
+	heap_chunk *chunk = heap->chunks;
+	obj_header *header;
+
+	if (bytes <= FREE_SMALL_MAX && heap->free_small[bytes / HEAP_ALIGN]) {
+		free_block *block = heap->free_small[bytes / HEAP_ALIGN];
+
+		heap->free_small[bytes / HEAP_ALIGN] = block->next;
+		header = (obj_header *) block;
+		goto found;
+	}
+
+	if (!chunk || chunk->top + bytes > chunk->end) {
+		header = take_free_block(heap, bytes);
+		if (header)
+			goto found;
+
+		if (chunk && bytes > HEAP_CHUNK_SIZE / 4) {
+			heap_chunk *large = new_chunk(bytes, HEAP_ALIGN);
+
+			if (!large)
+				return NULL;
+			large->next = chunk->next;
+			chunk->next = large;
+			heap->chunk_count++;
+			chunk = large;
+		} else {
+			/* the current chunk is always one to bump into */
+			chunk = new_bump_chunk();
+			if (!chunk)
+				return NULL;
+			chunk->next = heap->chunks;
+			heap->chunks = chunk;
+			heap->chunk_count++;
+			if (chunk->top + bytes > chunk->end)
+				return alloc_old(heap, bytes);
+		}
+	}
+
+	header = (obj_header *) chunk->top;
+	chunk->top += bytes;
+	set_start(chunk->starts, chunk->start, header);
+	header->size = bytes - OBJ_HEADER_SIZE;
+
+found:
+	heap->used += OBJ_HEADER_SIZE + header->size;
+	if (heap->used >= heap->next_gc)
+		heap->gc_pending |= GC_FULL;
+	return header;
+}
+
+static nursery_block *take_block(vm_heap *heap)
+{
+	nursery_block *block = heap->free_blocks;
+
+	heap->free_blocks = block->next;
+	block->next = heap->young;
+	heap->young = block;
+	heap->young_blocks++;
+	return block;
+}
+
+static obj_header *bump_block(nursery_block *block, unsigned int bytes)
+{
+	obj_header *header;
+
+	if (!block || block->top + bytes > block->start + NURSERY_BLOCK_SIZE)
+		return NULL;
+	header = (obj_header *) block->top;
+	block->top += bytes;
+	set_start(block->starts, block->start, header);
+	return header;
+}
+
+/*
+ * Room for a young object.  Once the blocks allocation may fill are full
+ * a minor collection is requested; until it has run, young objects are
+ * allocated old.  Pinned blocks do not count against the limit: they are
+ * never copied, so the to-space needs no room for them.
+ */
+static obj_header *alloc_young(vm_heap *heap, unsigned int bytes)
+{
+	obj_header *header = bump_block(heap->alloc_block, bytes);
+
+	if (header)
+		return header;
+	if (heap->young_blocks - heap->pinned_blocks >= heap->young_limit || !heap->free_blocks) {
+		heap->gc_pending |= GC_MINOR;
+		return NULL;
+	}
+	heap->alloc_block = take_block(heap);
+	return bump_block(heap->alloc_block, bytes);
+}
+
+/*
+ * Allocate a zeroed object of size payload bytes, in the nursery unless
+ * it is too big for it.  Allocation never collects by itself: it only
+ * sets gc_pending for the interpreter to act on.
+ */
+void *heap_alloc(vm_heap *heap, unsigned int size, int kind, const char *type)
+{
+	obj_header *header = NULL;
+	unsigned int bytes;
+
+	/* a free block must be able to hold its links */
+	size = ALIGN_UP(size ? size : 1);
+	bytes = OBJ_HEADER_SIZE + size;
+
+	if (bytes <= NURSERY_MAX_OBJECT && heap->nursery)
+		header = alloc_young(heap, bytes);
+	if (!header) {
+		header = alloc_old(heap, bytes);
+		if (!header)
+			return NULL;
+		size = header->size;
+	}
+
+	return init_object(heap, header, size, kind, type);
+}
+
+/*
+ * Allocate a zeroed object that is never moved or reclaimed, such as an
+ * interned string.  It lives outside both generations, so the collector
+ * takes it for a non-reference and never traces it: it must not refer to
+ * heap objects.  It is freed by heap_destroy().
+ */
+void *heap_alloc_permanent(vm_heap *heap, unsigned int size, int kind, const char *type)
+{
+	char *mem;
+
+	size = ALIGN_UP(size ? size : 1);
+	mem = malloc(HEAP_ALIGN + OBJ_HEADER_SIZE + size);
+	if (!mem)
+		return NULL;
+	*(void **) mem = heap->permanent;
+	heap->permanent = mem;
+
+	return init_object(heap, (obj_header *) (mem + HEAP_ALIGN), size, kind, type);
+}
+
+unsigned int heap_young_bytes(vm_heap *heap)
+{
+	nursery_block *block;
+	unsigned int bytes = 0;
+
+	for (block = heap->young; block; block = block->next)
+		bytes += block->top - block->start;
+	return bytes;
+}
+
+static heap_chunk *find_chunk(vm_heap *heap, unsigned long addr)
+{
+	heap_chunk *chunk;
+
+	for (chunk = heap->chunks; chunk; chunk = chunk->next)
+		if (addr >= (unsigned long) chunk->start && addr < (unsigned long) chunk->top)
+			return chunk;
+	return NULL;
+}
+
+/*
+ * Whether ptr is what heap_alloc() returned for a block that is still in
+ * the heap.  Registers carry no type, so this is how the collector tells
+ * a reference from an int that merely looks like one.
+ */
+int heap_is_object(vm_heap *heap, void *ptr)
+{
+	unsigned long addr = (unsigned long) ptr - OBJ_HEADER_SIZE;
+	heap_chunk *chunk;
+
+	if (!ptr || (addr & (HEAP_ALIGN - 1)))
+		return 0;
+	if (heap_is_young(heap, (void *) addr)) {
+		nursery_block *block = heap_block_of(heap, (void *) addr);
+
+		return addr < (unsigned long) block->top &&
+			test_start(block->starts, block->start, (void *) addr);
+	}
+	chunk = find_chunk(heap, addr);
+	return chunk && chunk_test_start(chunk, (void *) addr);
+}
+
+/*
+ * Queue obj so that the collector traces its references.  Should the
+ * mark stack fail to grow, the object is left flagged OBJ_GRAY and picked
+ * up by a heap rescan.
+ */
+void heap_push_gray(vm_heap *heap, void *obj)
+{
+	if (heap->mark_top == heap->mark_capacity) {
+		unsigned int new_size = heap->mark_capacity ? heap->mark_capacity * 2 : 256;
+		void **stack = realloc(heap->mark_stack, new_size * sizeof(void *));
+
+		if (!stack) {
+			obj_header_of(obj)->flags |= OBJ_GRAY;
+			heap->mark_overflow = 1;
+			return;
+		}
+		heap->mark_stack = stack;
+		heap->mark_capacity = new_size;
+	}
+	heap->mark_stack[heap->mark_top++] = obj;
+}
+
+static void push_gray_objects(vm_heap *heap, char *start, char *top)
+{
+	char *p;
+
+	for (p = start; p < top; p += OBJ_HEADER_SIZE + ((obj_header *) p)->size) {
+		obj_header *header = (obj_header *) p;
+
+		if (!(header->flags & OBJ_GRAY))
+			continue;
+		if (heap->mark_top == heap->mark_capacity) {
+			heap->mark_overflow = 1;
+			break;
+		}
+		header->flags &= ~OBJ_GRAY;
+		heap->mark_stack[heap->mark_top++] = p + OBJ_HEADER_SIZE;
+	}
+}
+
+/* Next queued object whose references are still to be traced, or NULL */
+void *heap_next_gray(vm_heap *heap)
+{
+	heap_chunk *chunk;
+	nursery_block *block;
+
+	while (!heap->mark_top && heap->mark_overflow) {
+		heap->mark_overflow = 0;
+		for (chunk = heap->chunks; chunk; chunk = chunk->next)
+			push_gray_objects(heap, chunk->start, chunk->top);
+		for (block = heap->young; block; block = block->next)
+			push_gray_objects(heap, block->start, block->top);
+	}
+	return heap->mark_top ? heap->mark_stack[--heap->mark_top] : NULL;
+}
+
+/*
+ * Mark the old object ptr refers to, if any, and queue it.  Young objects
+ * are left alone: a full collection empties the nursery first, and what
+ * is left in it is kept and traced as a root.
+ */
+void heap_mark(vm_heap *heap, void *ptr)
+{
+	obj_header *header;
+
+	if (heap_is_young(heap, ptr) || !heap_is_object(heap, ptr))
+		return;
+	header = obj_header_of(ptr);
+	if (header->kind == OBJ_FREE || (header->flags & OBJ_MARKED))
+		return;
+	header->flags |= OBJ_MARKED;
+	heap_push_gray(heap, ptr);
+}
+
+/*
+ * Reclaim every old object that was not marked and clear the marks of the
+ * rest.  Neighbouring dead objects and free blocks are merged, free space
+ * at the end of the current chunk goes back to the bump pointer, chunks
+ * left empty are released and the free lists are rebuilt from scratch.
+ */
+void heap_sweep(vm_heap *heap, heap_gc_stats *stats)
+{
+	heap_chunk **link = &heap->chunks;
+	heap_chunk *chunk;
+
+	memset(stats, 0, sizeof(heap_gc_stats));
+	memset(heap->free_small, 0, sizeof(heap->free_small));
+	heap->free_large = NULL;
+
+	while ((chunk = *link)) {
+		free_block *run = NULL;
+		char *p = chunk->start;
+
+		while (p < chunk->top) {
+			obj_header *header = (obj_header *) p;
+			unsigned int bytes = OBJ_HEADER_SIZE + header->size;
+
+			if (header->kind != OBJ_FREE && (header->flags & OBJ_MARKED)) {
+				header->flags &= ~OBJ_MARKED;
+				stats->live += bytes;
+				if (run)
+					free_list_add(heap, run);
+				run = NULL;
+			} else {
+				if (header->kind != OBJ_FREE) {
+					stats->objects++;
+					stats->bytes += bytes;
+				}
+				if (run) {
+					run->size += bytes;
+					clear_start(chunk->starts, chunk->start, header);
+				} else {
+					run = (free_block *) header;
+					run->kind = OBJ_FREE;
+					run->flags = 0;
+					run->chunk = chunk;
+				}
+			}
+			p += bytes;
+		}
+
+		if (run && (chunk == heap->chunks || (char *) run == chunk->start)) {
+			chunk->top = (char *) run;
+			clear_start(chunk->starts, chunk->start, run);
+		} else if (run) {
+			free_list_add(heap, run);
+		}
+
+		if (chunk->top == chunk->start && chunk != heap->chunks) {
+			*link = chunk->next;
+			free(chunk);
+			heap->chunk_count--;
+			continue;
+		}
+		link = &chunk->next;
+	}
+
+	heap->used = stats->live;
+	heap->freed += stats->bytes;
+	heap->collections++;
+	heap->gc_pending &= ~GC_FULL;
+	heap->next_gc = stats->live * 2 > GC_MIN_TRIGGER ? stats->live * 2 : GC_MIN_TRIGGER;
+	if (heap->next_gc > heap->limit)
+		heap->next_gc = heap->limit;
+}
+
+/*
+ * Start a minor collection.  The young blocks become the from-space;
+ * survivors are copied to blocks taken afresh.
+ */
+void heap_begin_minor(vm_heap *heap)
+{
+	nursery_block *block;
+
+	heap->from_space = heap->young;
+	for (block = heap->from_space; block; block = block->next)
+		block->state = BLOCK_FROM;
+	heap->young = NULL;
+	heap->young_blocks = 0;
+	heap->pinned_blocks = 0;
+	heap->kept_blocks = 0;
+	heap->alloc_block = NULL;
+	heap->to_block = NULL;
+}
+
+/* Keep the block of the young object ptr refers to, if any, in place */
+void heap_pin(vm_heap *heap, void *ptr)
+{
+	if (heap_is_young(heap, ptr) && heap_is_object(heap, ptr))
+		heap_block_of(heap, ptr)->state |= BLOCK_PINNED;
+}
+
+/* Move the from-space block at *link to the young blocks, queueing the
+ * objects in it that have not been copied out already */
+static void keep_block(vm_heap *heap, nursery_block **link)
+{
+	nursery_block *block = *link;
+	char *p;
+
+	*link = block->next;
+	block->state |= BLOCK_PINNED;
+	block->next = heap->young;
+	heap->young = block;
+	heap->young_blocks++;
+	heap->pinned_blocks++;
+	for (p = block->start; p < block->top; p += OBJ_HEADER_SIZE + ((obj_header *) p)->size)
+		if (!(((obj_header *) p)->flags & OBJ_FORWARDED))
+			heap_push_gray(heap, p + OBJ_HEADER_SIZE);
+}
+
+/*
+ * Take the pinned blocks out of the from-space.  Nothing in them is
+ * copied; all their objects are kept and queued to be traced.
+ */
+void heap_keep_pinned(vm_heap *heap)
+{
+	nursery_block **link = &heap->from_space;
+
+	while (*link) {
+		if ((*link)->state & BLOCK_PINNED)
+			keep_block(heap, link);
+		else
+			link = &(*link)->next;
+	}
+}
+
+/*
+ * Call scan for every old object whose header lies on a dirty card.  The
+ * cards are cleaned first; it is up to scan to dirty the card again if
+ * the object still refers to the nursery.
+ */
+void heap_scan_cards(vm_heap *heap, heap_object_func scan)
+{
+	heap_chunk *chunk;
+	unsigned int i;
+
+	for (chunk = heap->chunks; chunk; chunk = chunk->next) {
+		for (i = 0; i < chunk->card_count; i++) {
+			char *card = chunk->start + (i << CARD_SHIFT);
+			char *card_end = card + (1 << CARD_SHIFT);
+			char *p;
+
+			if (!chunk->cards[i])
+				continue;
+			chunk->cards[i] = 0;
+
+			/* the first block that starts on the card */
+			for (p = card; p < card_end && p < chunk->top; p += HEAP_ALIGN)
+				if (chunk_test_start(chunk, p))
+					break;
+			while (p < card_end && p < chunk->top) {
+				obj_header *header = (obj_header *) p;
+
+				if (header->kind != OBJ_FREE)
+					scan(heap, p + OBJ_HEADER_SIZE);
+				p += OBJ_HEADER_SIZE + header->size;
+			}
+		}
+	}
+}
+
+void heap_walk_young(vm_heap *heap, heap_object_func func)
+{
+	nursery_block *block;
+	char *p;
+
+	for (block = heap->young; block; block = block->next)
+		for (p = block->start; p < block->top; p += OBJ_HEADER_SIZE + ((obj_header *) p)->size)
+			func(heap, p + OBJ_HEADER_SIZE);
+}
+
+/*
+ * Evacuate the young object obj out of the from-space: copy it to the
+ * to-space, or promote it once it has survived tenure_age minor
+ * collections or the to-space has run out.  The old copy is left
+ * forwarding to the new one, which is queued to have its references
+ * traced.  Returns the new address.  With no room at all, the block of
+ * obj is kept in place as if it were pinned and obj is returned; the
+ * collection then reports that the heap is out of memory.
+ */
+void *heap_copy_young(vm_heap *heap, void *obj, int tenure_age)
+{
+	obj_header *header = obj_header_of(obj);
+	unsigned int bytes = OBJ_HEADER_SIZE + header->size;
+	unsigned int age = OBJ_AGE(header) + 1;
+	obj_header *copy = NULL;
+	void *new_obj;
+
+	if ((int) age < tenure_age) {
+		copy = bump_block(heap->to_block, bytes);
+		if (!copy && heap->free_blocks) {
+			heap->to_block = take_block(heap);
+			copy = bump_block(heap->to_block, bytes);
+		}
+	}
+	if (copy) {
+		memcpy(copy, header, bytes);
+	} else {
+		/* the block found may be bigger than the object */
+		copy = alloc_old(heap, bytes);
+		if (!copy) {
+			nursery_block **link = &heap->from_space;
+
+			while (*link != heap_block_of(heap, obj))
+				link = &(*link)->next;
+			keep_block(heap, link);
+			heap->kept_blocks++;
+			return obj;
+		}
+		memcpy((char *) copy + OBJ_HEADER_SIZE, obj, header->size);
+		copy->kind = header->kind;
+		copy->type = header->type;
+		heap->promoted += bytes;
+	}
+	copy->flags = age << OBJ_AGE_SHIFT;
+
+	new_obj = (char *) copy + OBJ_HEADER_SIZE;
+	header->flags |= OBJ_FORWARDED;
+	*(void **) obj = new_obj;
+	heap_push_gray(heap, new_obj);
+	return new_obj;
+}
+
+/*
+ * Finish a minor collection by releasing the evacuated from-space.
+ * Returns -1 if a block had to be kept because an object could not be
+ * copied out of it.
+ */
+int heap_end_minor(vm_heap *heap)
+{
+	nursery_block *block;
+	char *p;
+
+	while ((block = heap->from_space)) {
+		heap->from_space = block->next;
+		memset(block->starts, 0, sizeof(block->starts));
+		block->top = block->start;
+		block->state = 0;
+		block->next = heap->free_blocks;
+		heap->free_blocks = block;
+	}
+	for (block = heap->young; block; block = block->next) {
+		/* what was copied out of a kept block is dead space in it now */
+		if (heap->kept_blocks && (block->state & BLOCK_FROM))
+			for (p = block->start; p < block->top; p += OBJ_HEADER_SIZE + ((obj_header *) p)->size)
+				if (((obj_header *) p)->flags & OBJ_FORWARDED) {
+					((obj_header *) p)->kind = OBJ_FREE;
+					((obj_header *) p)->flags = 0;
+				}
+		block->state = 0;
+	}
+
+	/* allocation goes on behind the survivors */
+	heap->alloc_block = heap->to_block;
+	heap->to_block = NULL;
+	heap->minor_collections++;
+	heap->gc_pending &= ~GC_MINOR;
+	return heap->kept_blocks ? -1 : 0;
+}
+
+void heap_print_stats(vm_heap *heap)
+{
+	unsigned int i;
+
+	printf("heap: %u objects, %u bytes in %u chunk(s), %u young bytes in %u of %u nursery block(s)\n",
+	       heap->objects, heap->bytes, heap->chunk_count,
+	       heap_young_bytes(heap), heap->young_blocks, heap->block_count);
+	printf("gc: %u minor collection(s), %u bytes promoted; "
+	       "%u full collection(s), %u bytes freed, %u bytes in use\n",
+	       heap->minor_collections, heap->promoted,
+	       heap->collections, heap->freed, heap->used);
+	for (i = 0; i < heap->class_stats.capacity; i++) {
+		heap_class_stats *stats = heap->class_stats.entries[i].value;
+
+		if (!heap->class_stats.entries[i].hash)
+			continue;
+		printf("  %-32s %8u objects %10u bytes\n",
+		       stats->type, stats->objects, stats->bytes);
+	}
+}
@@ -0,0 +1,239 @@
+/*
+ * Simple Dalvik Virtual Machine Implementation
+ *
+ * VM-owned object heap
+ */
+
+#ifndef SIMPLE_DVM_HEAP_H
+#define SIMPLE_DVM_HEAP_H
+
+#include "hash_table.h"
+
+/*
+ * The heap has two generations.  New objects are bump-allocated in the
+ * nursery, a region cut into fixed-size blocks.  A minor collection copies
+ * the survivors out of the blocks allocated from (the from-space) into
+ * fresh blocks (the to-space), and promotes those that have survived
+ * TENURE_AGE minor collections to the old generation instead.
+ *
+ * The old generation is a list of chunks reclaimed by a full, mark-sweep
+ * collection.  Space it frees stays in the chunk as OBJ_FREE blocks that
+ * are handed out again from size-segregated free lists.
+ *
+ * Every object is preceded by an obj_header recording its size and kind,
+ * so both generations can be walked object by object; the pointer handed
+ * out points just past the header.
+ */
+
+#define HEAP_CHUNK_SIZE  (1024 * 1024)
+#define HEAP_ALIGN       8
+
+/* Heap limit unless -Xmx says otherwise */
+#define DEFAULT_HEAP_SIZE (64 * 1024 * 1024)
+
+/* Bytes in use before the first collection; later collections are
+ * triggered once the heap has doubled its live size */
+#define GC_MIN_TRIGGER   (4 * HEAP_CHUNK_SIZE)
+
+/* Free blocks of up to FREE_SMALL_MAX bytes are kept on exact-size lists */
+#define FREE_SMALL_MAX   256
+#define FREE_SMALL_LISTS (FREE_SMALL_MAX / HEAP_ALIGN + 1)
+
+/* Nursery size unless -Xmn says otherwise.  Allocation may fill half of
+ * the blocks; the other half is kept for the survivors of a minor
+ * collection. */
+#define DEFAULT_NURSERY_SIZE (2 * 1024 * 1024)
+#define NURSERY_BLOCK_SIZE   (32 * 1024)
+/* Bigger objects go to the old generation right away */
+#define NURSERY_MAX_OBJECT   (NURSERY_BLOCK_SIZE / 4)
+/* Minor collections an object survives before it is promoted */
+#define TENURE_AGE           2
+
+/* One card byte per 2^CARD_SHIFT bytes of an old chunk, dirtied when a
+ * reference to a young object is stored into an object whose header lies
+ * on the card */
+#define CARD_SHIFT       9
+
+/* What the payload of a heap object is */
+enum {
+	OBJ_INSTANCE = 1,	/* instance_obj followed by its fields */
+	OBJ_ARRAY,		/* array_obj */
+	OBJ_STRING,		/* String followed by its characters */
+	OBJ_LONG,		/* Long */
+	OBJ_STRING_BUILDER,	/* StringBuilder */
+	OBJ_FREE,		/* unused space left by a collection */
+};
+
+/* obj_header flags */
+#define OBJ_MARKED    0x1
+#define OBJ_GRAY      0x2	/* reached, but left off a full mark stack */
+#define OBJ_FORWARDED 0x4	/* copied; the payload starts with the copy */
+#define OBJ_AGE_SHIFT 8		/* minor collections survived */
+#define OBJ_AGE(header) ((header)->flags >> OBJ_AGE_SHIFT)
+
+typedef struct _obj_header {
+	unsigned int size;	/* payload bytes */
+	unsigned short kind;
+	unsigned short flags;
+	const char *type;	/* class descriptor, for statistics */
+} obj_header;
+
+#define OBJ_HEADER_SIZE ((sizeof(obj_header) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1))
+
+/*
+ * Chunks are aligned to HEAP_CHUNK_SIZE and every object header lies in
+ * the first HEAP_CHUNK_SIZE bytes of its chunk, so the write barrier finds
+ * the cards of an object by masking its address.
+ */
+typedef struct _heap_chunk {
+	struct _heap_chunk *next;
+	char *top;		/* first free byte */
+	char *end;
+	char *start;		/* first object */
+	/* one bit per HEAP_ALIGN bytes, set where a block header starts, so
+	 * a value can be checked for being an object without trusting it */
+	unsigned char *starts;
+	unsigned int map_size;	/* bytes from start that starts and cards cover */
+	unsigned char *cards;
+	unsigned int card_count;
+} heap_chunk;
+
+/* A free block reuses the header of the space it took over */
+typedef struct _free_block {
+	unsigned int size;	/* payload bytes */
+	unsigned short kind;	/* OBJ_FREE */
+	unsigned short flags;
+	struct _free_block *next;
+	heap_chunk *chunk;	/* overlaps the payload on 64-bit hosts */
+} free_block;
+
+/* nursery_block state */
+#define BLOCK_FROM   0x1	/* being evacuated by the current minor collection */
+#define BLOCK_PINNED 0x2	/* kept in place by the current minor collection */
+
+typedef struct _nursery_block {
+	struct _nursery_block *next;
+	char *start;
+	char *top;
+	int state;
+	unsigned char starts[NURSERY_BLOCK_SIZE / HEAP_ALIGN / 8];
+} nursery_block;
+
+typedef struct _heap_class_stats {
+	const char *type;
+	unsigned int objects;
+	unsigned int bytes;
+} heap_class_stats;
+
+typedef struct _heap_gc_stats {
+	unsigned int objects;	/* reclaimed */
+	unsigned int bytes;
+	unsigned int live;	/* bytes surviving */
+} heap_gc_stats;
+
+/* gc_pending */
+#define GC_MINOR 0x1
+#define GC_FULL  0x2
+
+typedef struct _vm_heap {
+	heap_chunk *chunks;	/* the first chunk is the one allocated from */
+	unsigned int chunk_count;
+	unsigned int objects;	/* allocated since heap_init */
+	unsigned int bytes;	/* including headers */
+	struct hash_table class_stats;	/* type -> heap_class_stats */
+
+	unsigned int used;	/* bytes of old objects not yet reclaimed */
+	unsigned int limit;	/* most bytes a full collection may leave live */
+	unsigned int next_gc;	/* used at which a full collection is requested */
+	int gc_pending;		/* GC_* bits, polled by the interpreter at safe points */
+	unsigned int collections;
+	unsigned int freed;	/* bytes reclaimed by all full collections */
+	free_block *free_small[FREE_SMALL_LISTS];	/* by block bytes / HEAP_ALIGN */
+	free_block *free_large;
+
+	char *nursery;
+	char *nursery_end;
+	nursery_block *blocks;
+	unsigned int block_count;
+	nursery_block *free_blocks;
+	nursery_block *young;	/* blocks holding young objects */
+	unsigned int young_blocks;
+	unsigned int young_limit;	/* blocks allocation may fill */
+	unsigned int pinned_blocks;	/* young blocks kept by the last minor collection */
+	nursery_block *alloc_block;
+	nursery_block *to_block;	/* survivors are copied here */
+	nursery_block *from_space;	/* blocks the running minor collection evacuates */
+	unsigned int kept_blocks;	/* from-space blocks an object could not be copied out of */
+	int statics_dirty;	/* a static field may refer to a young object */
+	unsigned int minor_collections;
+	unsigned int promoted;	/* bytes promoted by all minor collections */
+
+	void *permanent;	/* objects outside both generations, linked */
+
+	void **mark_stack;	/* objects whose references are not traced yet */
+	unsigned int mark_top;
+	unsigned int mark_capacity;
+	int mark_overflow;	/* some objects are only flagged OBJ_GRAY */
+} vm_heap;
+
+typedef void (*heap_object_func)(vm_heap *heap, void *obj);
+
+static inline obj_header *obj_header_of(void *obj)
+{
+	return (obj_header *) ((char *) obj - OBJ_HEADER_SIZE);
+}
+
+static inline int heap_is_young(vm_heap *heap, void *ptr)
+{
+	return (char *) ptr >= heap->nursery && (char *) ptr < heap->nursery_end;
+}
+
+static inline nursery_block *heap_block_of(vm_heap *heap, void *ptr)
+{
+	return &heap->blocks[((char *) ptr - heap->nursery) / NURSERY_BLOCK_SIZE];
+}
+
+static inline void heap_card_mark(void *obj)
+{
+	char *header = (char *) obj_header_of(obj);
+	heap_chunk *chunk = (heap_chunk *) ((unsigned long) header & ~(HEAP_CHUNK_SIZE - 1));
+
+	chunk->cards[(header - chunk->start) >> CARD_SHIFT] = 1;
+}
+
+/* Write barrier, called after a reference to value was stored into obj */
+static inline void heap_write_barrier(vm_heap *heap, void *obj, void *value)
+{
+	if (heap_is_young(heap, value) && !heap_is_young(heap, obj))
+		heap_card_mark(obj);
+}
+
+/* Write barrier of the static fields, which all share a single card */
+static inline void heap_static_barrier(vm_heap *heap, void *value)
+{
+	if (heap_is_young(heap, value))
+		heap->statics_dirty = 1;
+}
+
+void heap_init(vm_heap *heap, unsigned int limit, unsigned int nursery_size);
+void heap_destroy(vm_heap *heap);
+void *heap_alloc(vm_heap *heap, unsigned int size, int kind, const char *type);
+void *heap_alloc_permanent(vm_heap *heap, unsigned int size, int kind, const char *type);
+void heap_print_stats(vm_heap *heap);
+unsigned int heap_young_bytes(vm_heap *heap);
+
+int heap_is_object(vm_heap *heap, void *ptr);
+void heap_push_gray(vm_heap *heap, void *obj);
+void *heap_next_gray(vm_heap *heap);
+void heap_mark(vm_heap *heap, void *ptr);
+void heap_sweep(vm_heap *heap, heap_gc_stats *stats);
+
+void heap_begin_minor(vm_heap *heap);
+void heap_pin(vm_heap *heap, void *ptr);
+void heap_keep_pinned(vm_heap *heap);
+void heap_scan_cards(vm_heap *heap, heap_object_func scan);
+void heap_walk_young(vm_heap *heap, heap_object_func func);
+void *heap_copy_young(vm_heap *heap, void *obj, int tenure_age);
+int heap_end_minor(vm_heap *heap);
+
+#endif
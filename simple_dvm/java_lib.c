@@ -6,19 +6,29 @@
 
 #define _POSIX_C_SOURCE 199309L
 #include "java_lib.h"
+#include <float.h>
+#include <unistd.h>
 #include <time.h>
 
 // Ljava/lang/Integer
 class_obj java_lang_Integer;
-obj_field java_lang_Integer_fields[] = {
-	{.name = "TYPE", .type = "Ljava/lang/Class;", .data.vdata = &java_lang_Integer, },
+static void *java_lang_Integer_statics[] = {
+	&java_lang_Integer,
+};
+field_info java_lang_Integer_fields[] = {
+	{.name = "TYPE", .type = "Ljava/lang/Class;", .offset = 0, .size = sizeof(void *), },
 };
 class_obj java_lang_Integer = {
 	.name = "Ljava/lang/Integer;",
 	.fields = java_lang_Integer_fields,
-	.field_size = sizeof(java_lang_Integer_fields)/sizeof(obj_field),
+	.field_size = sizeof(java_lang_Integer_fields)/sizeof(field_info),
+	.statics = (u1 *) java_lang_Integer_statics,
 };
 
+/* descriptors of the library objects allocated on the VM heap */
+static const char java_lang_String[] = "Ljava/lang/String;";
+static const char java_lang_Long[] = "Ljava/lang/Long;";
+
 static java_lang_clz clz_table[] = {
 	{"Ljava/lang/Integer;", &java_lang_Integer},
 };
@@ -50,6 +60,81 @@ int java_io_inputstreamreader_init(DexFileFormat *dex, simple_dalvik_vm *vm, cha
     return 0;
 }
 
+/*
+ * Bytes of the MUTF-8 sequence at s, which ends before end.  A lead byte
+ * not followed by its continuation bytes counts as a character by itself.
+ */
+static int utf8_seq_len(const unsigned char *s, const unsigned char *end)
+{
+	int n = s[0] < 0xc0 ? 1 : s[0] < 0xe0 ? 2 : s[0] < 0xf0 ? 3 : 4;
+	int i;
+
+	if (s + n > end)
+		return 1;
+	for (i = 1; i < n; i++)
+		if ((s[i] & 0xc0) != 0x80)
+			return 1;
+	return n;
+}
+
+/* UTF-16 code units of the len bytes of MUTF-8 at chars.  Only text read
+ * from outside can hold a 4-byte sequence, which takes a surrogate pair. */
+static int utf16_length(const char *chars, int len)
+{
+	const unsigned char *p = (const unsigned char *) chars;
+	const unsigned char *end = p + len;
+	int units = 0;
+	int n;
+
+	for (; p < end; p += n) {
+		n = utf8_seq_len(p, end);
+		units += n == 4 ? 2 : 1;
+	}
+	return units;
+}
+
+/* The code point of the n-byte sequence at p that utf8_seq_len() found */
+static unsigned int utf8_decode(const unsigned char *p, int n)
+{
+	switch (n) {
+	case 2:
+		return ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+	case 3:
+		return ((p[0] & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+	case 4:
+		return ((p[0] & 0x07) << 18) | ((p[1] & 0x3f) << 12) |
+			((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+	default:
+		return p[0];
+	}
+}
+
+/* The surrogates of a code point beyond U+FFFF */
+#define HIGH_SURROGATE(c) (0xd800 | (((c) - 0x10000) >> 10))
+#define LOW_SURROGATE(c)  (0xdc00 | (((c) - 0x10000) & 0x3ff))
+
+/* UTF-16 code unit idx of s, which must be below s->length */
+static int utf16_char_at(String *s, int idx)
+{
+	const unsigned char *p = (const unsigned char *) s->buf;
+	const unsigned char *end = p + s->buf_size - 1;
+	unsigned int c;
+	int n;
+
+	/* all ASCII: a unit per byte */
+	if (s->length == s->buf_size - 1)
+		return p[idx];
+	for (;; p += n, idx -= n == 4 ? 2 : 1) {
+		n = utf8_seq_len(p, end);
+		if (idx < (n == 4 ? 2 : 1))
+			break;
+	}
+	c = utf8_decode(p, n);
+	if (n == 4)
+		return idx ? LOW_SURROGATE(c) : HIGH_SURROGATE(c);
+	return c;
+}
+
 /* java.io.BufferedReader */
 static char read_buf[2048];
 
@@ -70,12 +155,13 @@ int java_io_bufferedreader_readline(DexFileFormat *dex, simple_dalvik_vm *vm, ch
         printf("call java.io.BufferedReader.readLine\n");
 	fgets(read_buf, sizeof(read_buf), stdin);
 
-	s = malloc(sizeof(String) + strlen(read_buf) + 1);
+	s = heap_alloc(&vm->heap, sizeof(String) + strlen(read_buf) + 1, OBJ_STRING, java_lang_String);
 	if (!s)
 		return -1;
 	s->buf_size = strlen(read_buf) + 1;
 	s->buf = (char *) s + sizeof(String);
 	strcpy(s->buf, read_buf);
+	s->length = utf16_length(s->buf, s->buf_size - 1);
 	// remove the newline character
 	strtok(s->buf, "\n");
 
@@ -84,27 +170,6 @@ int java_io_bufferedreader_readline(DexFileFormat *dex, simple_dalvik_vm *vm, ch
     return 0;
 }
 
-int java_io_print_stream_println(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
-{
-    invoke_parameters *p = &vm->p;
-    String *s;
-
-    if (is_verbose())
-        printf("call java.io.PrintStream.println\n");
-
-	if (type != 0) {
-		if (strcmp(type, "Ljava/lang/String;") == 0) {
-			load_reg_to(vm, p->reg_idx[1], (unsigned char *) &s);
-			printf("%s\n", s->buf);
-		}
-	}
-	else {
-		printf("\n");
-	}
-
-    return 0;
-}
-
 int java_lang_long_valueof(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
 {
     invoke_parameters *p = &vm->p;
@@ -114,7 +179,9 @@ int java_lang_long_valueof(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
         printf("call java.lang.Long.valueOf\n");
 
     load_reg_to(vm, p->reg_idx[0], (unsigned char *) &s);
-	l = malloc(sizeof(Long));
+	l = heap_alloc(&vm->heap, sizeof(Long), OBJ_LONG, java_lang_Long);
+	if (!l)
+		return -1;
 	l->val = atoll(s->buf);
 
 	store_to_bottom_half_result(vm, (unsigned char *) &l);
@@ -138,38 +205,155 @@ int java_lang_long_longvalue(DexFileFormat *dex, simple_dalvik_vm *vm, char *typ
 
 String* java_lang_string_const_string(DexFileFormat *dex, simple_dalvik_vm *vm, char *c_str, int len)
 {
-	String *s = malloc(sizeof(String) + len + 1);
+	String *s = heap_alloc(&vm->heap, sizeof(String) + len + 1, OBJ_STRING, java_lang_String);
 
 	if (!s)
-		return -1;
+		return NULL;
 
 	s->buf_size = len + 1;
 	s->buf = (char *) s + sizeof(String);
 	strncpy(s->buf, c_str, len);
 	s->buf[len] = '\0';
+	s->length = utf16_length(s->buf, len);
 
     return s;
 }
 
+/*
+ * The String of const-string string_id.  It is created once, outside the
+ * collected heap, with its characters left in the dex string pool, and
+ * handed out again by every later const-string of the same string_id.
+ */
+String *java_lang_string_intern(DexFileFormat *dex, simple_dalvik_vm *vm, int string_id)
+{
+	String *s;
+
+	if (string_id < vm->string_count && vm->strings[string_id])
+		return vm->strings[string_id];
+
+	s = heap_alloc_permanent(&vm->heap, sizeof(String), OBJ_STRING, java_lang_String);
+	if (!s)
+		return NULL;
+	s->buf = get_string_data(dex, string_id);
+	s->buf_size = strlen(s->buf) + 1;
+	s->length = get_string_length(dex, string_id);
+
+	if (string_id < vm->string_count)
+		vm->strings[string_id] = s;
+	return s;
+}
+
+static int is_string(void *obj)
+{
+	obj_header *header;
+
+	if (!obj)
+		return 0;
+	header = obj_header_of(obj);
+	return header->kind == OBJ_STRING && header->type == java_lang_String;
+}
+
 int java_lang_string_charat(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
 {
     invoke_parameters *p = &vm->p;
 	String *this;
 	int idx;
-	char c;
+	int c = 0;
     if (is_verbose())
         printf("call java.lang.String.charAt\n");
 
     load_reg_to(vm, p->reg_idx[0], (unsigned char *) &this);
-    load_reg_to(vm, p->reg_idx[1], (unsigned char *) &idx);
-	if (idx < this->buf_size)
-		c = this->buf[idx];
+    idx = get_reg_int(vm, p->reg_idx[1]);
+	if ((unsigned int) idx < (unsigned int) this->length)
+		c = utf16_char_at(this, idx);
 	// else exception
 	store_to_bottom_half_result(vm, (unsigned char *) &c);
 
     return 0;
 }
 
+int java_lang_string_length(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+    invoke_parameters *p = &vm->p;
+	String *this;
+	int length;
+
+    if (is_verbose())
+        printf("call java.lang.String.length\n");
+
+    load_reg_to(vm, p->reg_idx[0], (unsigned char *) &this);
+	length = this->length;
+	store_to_bottom_half_result(vm, (unsigned char *) &length);
+
+    return 0;
+}
+
+/* s[0] * 31^(n - 1) + s[1] * 31^(n - 2) + ... + s[n - 1] over the UTF-16
+ * code units, computed once */
+int java_lang_string_hashcode(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+    invoke_parameters *p = &vm->p;
+	String *this;
+	unsigned int h = 0;
+	int i;
+
+    if (is_verbose())
+        printf("call java.lang.String.hashCode\n");
+
+    load_reg_to(vm, p->reg_idx[0], (unsigned char *) &this);
+	if (!this->hash && this->length == this->buf_size - 1)
+	{
+		/* all ASCII: a unit per byte */
+		for (i = 0; i < this->buf_size - 1; i++)
+			h = 31 * h + (unsigned char) this->buf[i];
+		this->hash = h;
+	}
+	else if (!this->hash)
+	{
+		const unsigned char *s = (const unsigned char *) this->buf;
+		const unsigned char *end = s + this->buf_size - 1;
+		unsigned int c;
+		int n;
+
+		for (; s < end; s += n) {
+			n = utf8_seq_len(s, end);
+			c = utf8_decode(s, n);
+			if (n == 4)
+				h = 31 * (31 * h + HIGH_SURROGATE(c)) + LOW_SURROGATE(c);
+			else
+				h = 31 * h + c;
+		}
+		this->hash = h;
+	}
+	store_to_bottom_half_result(vm, (unsigned char *) &this->hash);
+
+    return 0;
+}
+
+int java_lang_string_equals(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+    invoke_parameters *p = &vm->p;
+	String *this, *other;
+	int equal;
+
+    if (is_verbose())
+        printf("call java.lang.String.equals\n");
+
+    load_reg_to(vm, p->reg_idx[0], (unsigned char *) &this);
+    load_reg_to(vm, p->reg_idx[1], (unsigned char *) &other);
+
+	if (this == other)
+		equal = 1;
+	else if (!is_string(other) || this->buf_size != other->buf_size ||
+		 (this->hash && other->hash && this->hash != other->hash))
+		equal = 0;
+	else
+		equal = !memcmp(this->buf, other->buf, this->buf_size - 1);
+	store_to_bottom_half_result(vm, (unsigned char *) &equal);
+
+    return 0;
+}
+
 int java_lang_string_compareto(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
 {
     invoke_parameters *p = &vm->p;
@@ -202,32 +386,344 @@ int java_lang_string_compareto(DexFileFormat *dex, simple_dalvik_vm *vm, char *t
     return 0;
 }
 
-/* java.lang.StringBuilder.<init> */
+/* StringBuilder capacity unless <init> is given one */
+#define STRING_BUILDER_CAPACITY 32
+
+/* A String of no characters with room for capacity bytes, NUL included */
+static String *alloc_string(simple_dalvik_vm *vm, int capacity)
+{
+	String *s = heap_alloc(&vm->heap, sizeof(String) + capacity, OBJ_STRING, java_lang_String);
+
+	if (!s)
+		return NULL;
+	s->buf_size = 1;
+	s->buf = (char *) s + sizeof(String);
+	return s;
+}
+
+static int string_capacity(String *s)
+{
+	return obj_header_of(s)->size - sizeof(String);
+}
+
+/*
+ * Append len bytes to the builder.  Its String is replaced by one of
+ * twice the capacity when they do not fit, or by a copy when toString()
+ * has handed it out.
+ */
+static int sb_append(simple_dalvik_vm *vm, StringBuilder *sb, const char *chars, int len)
+{
+	String *str = sb->str;
+	int length = str->buf_size - 1;
+
+	if (sb->shared || length + len + 1 > string_capacity(str)) {
+		int capacity = string_capacity(str);
+		String *copy;
+
+		if (length + len + 1 > capacity)
+			capacity = length + len + 1 > capacity * 2 ? length + len + 1 : capacity * 2;
+		copy = alloc_string(vm, capacity);
+		if (!copy)
+			return -1;
+		memcpy(copy->buf, str->buf, length);
+		copy->length = str->length;
+		sb->str = str = copy;
+		sb->shared = 0;
+		heap_write_barrier(&vm->heap, sb, copy);
+	}
+
+	memcpy(str->buf + length, chars, len);
+	str->buf[length + len] = '\0';
+	str->buf_size = length + len + 1;
+	str->length += utf16_length(chars, len);
+	return 0;
+}
+
+/* Write the decimal digits of value to end backwards; returns their count */
+static int format_long(char *end, long long value)
+{
+	unsigned long long u = value < 0 ? -(unsigned long long) value : value;
+	unsigned int low;
+	char *p = end;
+
+	/* 64-bit division is a library call on 32-bit hosts */
+	while (u > 0xffffffffULL) {
+		*--p = '0' + u % 10;
+		u /= 10;
+	}
+	low = u;
+	do {
+		*--p = '0' + low % 10;
+		low /= 10;
+	} while (low);
+	if (value < 0)
+		*--p = '-';
+	return end - p;
+}
+
+static int copy_str(char *out, const char *s)
+{
+	int len = strlen(s);
+
+	memcpy(out, s, len);
+	return len;
+}
+
+/*
+ * Format d the way Double.toString() does: the fewest digits that read
+ * back as d, in plain notation for 10^-3 <= |d| < 10^7 and as "d.dddE<n>"
+ * otherwise.  For a float, digits only need to read back as the float.
+ */
+static int format_double(char *out, double d, int is_float)
+{
+	char digits[32];
+	char *p = out;
+	char *e;
+	int prec, max_prec = is_float ? 9 : 17;
+	int exp, n, i;
+
+	if (d != d)
+		return copy_str(out, "NaN");
+	if (d < 0 || (d == 0 && 1 / d < 0)) {
+		*p++ = '-';
+		d = -d;
+	}
+	if (d > DBL_MAX)
+		return p - out + copy_str(p, "Infinity");
+	if (d == 0)
+		return p - out + copy_str(p, "0.0");
+
+	/* the shortest "%e" precision that round-trips gives the digits */
+	for (prec = 1; prec < max_prec; prec++) {
+		snprintf(digits, sizeof(digits), "%.*e", prec - 1, d);
+		if (is_float ? (float) strtod(digits, NULL) == (float) d : strtod(digits, NULL) == d)
+			break;
+	}
+	snprintf(digits, sizeof(digits), "%.*e", prec - 1, d);
+	e = strchr(digits, 'e');
+	exp = atoi(e + 1);
+	/* gather the mantissa digits without the point and trailing zeros */
+	n = 0;
+	for (i = 0; digits + i < e; i++)
+		if (digits[i] != '.')
+			digits[n++] = digits[i];
+	while (n > 1 && digits[n - 1] == '0')
+		n--;
+
+	if (exp >= -3 && exp < 7) {
+		if (exp < 0) {
+			*p++ = '0';
+			*p++ = '.';
+			for (i = -1; i > exp; i--)
+				*p++ = '0';
+			memcpy(p, digits, n);
+			p += n;
+		} else {
+			for (i = 0; i <= exp; i++)
+				*p++ = i < n ? digits[i] : '0';
+			*p++ = '.';
+			if (n > exp + 1) {
+				memcpy(p, digits + exp + 1, n - exp - 1);
+				p += n - exp - 1;
+			} else {
+				*p++ = '0';
+			}
+		}
+	} else {
+		char num[12];
+		int len = format_long(num + sizeof(num), exp);
+
+		*p++ = digits[0];
+		*p++ = '.';
+		if (n > 1) {
+			memcpy(p, digits + 1, n - 1);
+			p += n - 1;
+		} else {
+			*p++ = '0';
+		}
+		*p++ = 'E';
+		memcpy(p, num + sizeof(num) - len, len);
+		p += len;
+	}
+	return p - out;
+}
+
+/* Encode the UTF-16 unit c as the MUTF-8 the rest of the VM's strings
+ * use, where U+0000 takes two bytes so that no NUL ends a string early */
+static int format_char(char *out, unsigned int c)
+{
+	if (c && c < 0x80) {
+		out[0] = c;
+		return 1;
+	}
+	if (c < 0x800) {
+		out[0] = 0xc0 | (c >> 6);
+		out[1] = 0x80 | (c & 0x3f);
+		return 2;
+	}
+	out[0] = 0xe0 | (c >> 12);
+	out[1] = 0x80 | ((c >> 6) & 0x3f);
+	out[2] = 0x80 | (c & 0x3f);
+	return 3;
+}
+
+/*
+ * Format the argument of a print or append whose parameter is type, taken
+ * from the register after the receiver.  Numbers go to num, which must be
+ * FORMAT_BUF_SIZE bytes; *out is set to the text.  Returns its length, or
+ * -1 for an object that is not a String.
+ */
+#define FORMAT_BUF_SIZE 32
+static int format_value(simple_dalvik_vm *vm, char *type, char *num, const char **out)
+{
+    invoke_parameters *p = &vm->p;
+	String *s;
+	int len;
+
+	*out = num;
+	if (strcmp(type, "Ljava/lang/String;") == 0 || strcmp(type, "Ljava/lang/CharSequence;") == 0 ||
+		strcmp(type, "Ljava/lang/Object;") == 0) {
+		load_reg_to(vm, p->reg_idx[1], (unsigned char *) &s);
+		if (!s) {
+			*out = "null";
+			return 4;
+		}
+		if (!is_string(s))
+			return -1;
+		*out = s->buf;
+		return s->buf_size - 1;
+	} else if (strcmp(type, "I") == 0) {
+		len = format_long(num + FORMAT_BUF_SIZE, get_reg_int(vm, p->reg_idx[1]));
+		*out = num + FORMAT_BUF_SIZE - len;
+		return len;
+	} else if (strcmp(type, "J") == 0) {
+		len = format_long(num + FORMAT_BUF_SIZE, get_reg_long(vm, p->reg_idx[1]));
+		*out = num + FORMAT_BUF_SIZE - len;
+		return len;
+	} else if (strcmp(type, "C") == 0) {
+		return format_char(num, get_reg_int(vm, p->reg_idx[1]) & 0xffff);
+	} else if (strcmp(type, "Z") == 0) {
+		*out = get_reg_int(vm, p->reg_idx[1]) ? "true" : "false";
+		return strlen(*out);
+	} else if (strcmp(type, "D") == 0) {
+		return format_double(num, get_reg_double(vm, p->reg_idx[1]), 0);
+	} else if (strcmp(type, "F") == 0) {
+		return format_double(num, get_reg_float(vm, p->reg_idx[1]), 1);
+	}
+	return -1;
+}
+
+/*
+ * System.out is stdout with a buffer of -Xout bytes owned by the VM, so
+ * a program printing a lot makes one write per buffer rather than one per
+ * line, and the VM's own messages stay in order with it.  A terminal is
+ * still flushed at each newline.  The buffer lives until exit.
+ */
+static char *stdout_buf;
+
+int java_io_init_stdout(uint size)
+{
+	if (size == 0)
+		return setvbuf(stdout, NULL, _IONBF, 0);
+	stdout_buf = malloc(size);
+	if (!stdout_buf) {
+		printf("out of memory for a %u byte output buffer\n", size);
+		return -1;
+	}
+	return setvbuf(stdout, stdout_buf, isatty(fileno(stdout)) ? _IOLBF : _IOFBF, size);
+}
+
+void java_io_flush_stdout()
+{
+	fflush(stdout);
+}
+
+static int print_stream_print(simple_dalvik_vm *vm, char *type, int newline)
+{
+	char num[FORMAT_BUF_SIZE];
+	const char *out;
+	int len;
+
+	if (type != 0) {
+		len = format_value(vm, type, num, &out);
+		if (len > 0)
+			fwrite(out, 1, len, stdout);
+	}
+	if (newline)
+		putchar('\n');
+	return 0;
+}
+
+/* java.io.PrintStream.println, () or of a String or primitive */
+int java_io_print_stream_println(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+    if (is_verbose())
+        printf("call java.io.PrintStream.println\n");
+
+    return print_stream_print(vm, type, 1);
+}
+
+int java_io_print_stream_print(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+    if (is_verbose())
+        printf("call java.io.PrintStream.print\n");
+
+    return print_stream_print(vm, type, 0);
+}
+
+int java_io_print_stream_flush(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+    if (is_verbose())
+        printf("call java.io.PrintStream.flush\n");
+
+    java_io_flush_stdout();
+    return 0;
+}
+
+/* java.lang.StringBuilder.<init>, (), (int capacity) or (String) */
 int java_lang_string_builder_init(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
 {
     invoke_parameters *p = &vm->p;
 	instance_obj *ins_obj;
+	StringBuilder *sb;
+	String *s = NULL;
+	int capacity = STRING_BUILDER_CAPACITY;
     if (is_verbose())
         printf("call java.lang.StringBuilder.<init>\n");
 
     load_reg_to(vm, p->reg_idx[0], (unsigned char *) &ins_obj);
-	ins_obj->priv_data = (void *) malloc(sizeof(StringBuilder)); 
-	if (!ins_obj->priv_data)
+	if (type && !strcmp(type, "I") && get_reg_int(vm, p->reg_idx[1]) > 0) {
+		capacity = get_reg_int(vm, p->reg_idx[1]) + 1;
+	} else if (type && !strcmp(type, "Ljava/lang/String;")) {
+		load_reg_to(vm, p->reg_idx[1], (unsigned char *) &s);
+		if (s)
+			capacity += s->buf_size;
+	}
+
+	sb = heap_alloc(&vm->heap, sizeof(StringBuilder), OBJ_STRING_BUILDER, ins_obj->cls->name);
+	if (!sb)
 		return -1;
-    memset(ins_obj->priv_data, 0, sizeof(StringBuilder));
+	sb->str = alloc_string(vm, capacity);
+	if (!sb->str)
+		return -1;
+	heap_write_barrier(&vm->heap, sb, sb->str);
+	ins_obj->priv_data = sb;
+	heap_write_barrier(&vm->heap, ins_obj, sb);
 
+	if (s)
+		return sb_append(vm, sb, s->buf, s->buf_size - 1);
     return 0;
 }
 
 int java_lang_string_builder_append(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
 {
     invoke_parameters *p = &vm->p;
-	int value = 0;
-	String *s;
-	long long long_value;
-	unsigned char *ptr_long = (unsigned char *) &long_value;
 	instance_obj *ins_obj;
 	StringBuilder *sb;
+	char num[FORMAT_BUF_SIZE];
+	const char *out;
+	int len;
+	int ret = 0;
     if (is_verbose())
         printf("call java.lang.StringBuilder.append\n");
 
@@ -235,61 +731,69 @@ int java_lang_string_builder_append(DexFileFormat *dex, simple_dalvik_vm *vm, ch
 	sb = (StringBuilder *) ins_obj->priv_data;
 
     if (type != 0) {
-        if (strcmp(type, "Ljava/lang/String;") == 0) {
-			load_reg_to(vm, p->reg_idx[1], (unsigned char *) &s);
-            sb->buf_ptr += snprintf(sb->buf + sb->buf_ptr, 1024, "%s", s->buf);
-        } else if (strcmp(type, "I") == 0) {
-			load_reg_to(vm, p->reg_idx[1], (unsigned char *) &value);
-            sb->buf_ptr += snprintf(sb->buf + sb->buf_ptr, 1024, "%d", value);
-        } else if (strcmp(type, "J") == 0) {
-			load_reg_to_double(vm, p->reg_idx[1], ptr_long + 4);
-			load_reg_to_double(vm, p->reg_idx[2], ptr_long);
-            sb->buf_ptr += snprintf(sb->buf + sb->buf_ptr, 1024, "%d", long_value);
-        }
+		len = format_value(vm, type, num, &out);
+		if (len >= 0)
+			ret = sb_append(vm, sb, out, len);
 		store_to_bottom_half_result(vm, (unsigned char *) &ins_obj);
     }
 
-    return 0;
+    return ret;
 }
 
+/* Hands out the builder's own String, which a later append copies first */
 int java_lang_string_builder_to_string(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
 {
     invoke_parameters *p = &vm->p;
 	instance_obj *ins_obj;
 	StringBuilder *sb;
-	String *s;
     if (is_verbose())
         printf("call java.lang.StringBuilder.toString\n");
 
     load_reg_to(vm, p->reg_idx[0], (unsigned char *) &ins_obj);
 	sb = (StringBuilder *) ins_obj->priv_data;
 
-	s = java_lang_string_const_string(dex, vm, sb->buf, sb->buf_ptr);
+	sb->shared = 1;
+	store_to_bottom_half_result(vm, (unsigned char *) &sb->str);
 
-	store_to_bottom_half_result(vm, (unsigned char *) &s);
+    return 0;
+}
+
+int java_lang_string_builder_length(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+    invoke_parameters *p = &vm->p;
+	instance_obj *ins_obj;
+	int length;
+    if (is_verbose())
+        printf("call java.lang.StringBuilder.length\n");
+
+    load_reg_to(vm, p->reg_idx[0], (unsigned char *) &ins_obj);
+	length = ((StringBuilder *) ins_obj->priv_data)->str->length;
+	store_to_bottom_half_result(vm, (unsigned char *) &length);
 
     return 0;
 }
 
-array_obj *array_create_multi_dimension(DexFileFormat *dex, simple_dalvik_vm *vm, array_obj *dim, int dimension)
+/* type is the descriptor of the outermost array; the arrays of each
+ * further dimension drop one '[' of it */
+array_obj *array_create_multi_dimension(DexFileFormat *dex, simple_dalvik_vm *vm, array_obj *dim, int dimension,
+		const char *type)
 {
 	array_obj *arr_obj;
-	int size = (int)dim->ptr[dimension];
+	int size = ((int *)dim->data)[dimension];
 	int i;
 
-	arr_obj = (array_obj *)malloc(sizeof(array_obj) + (size - 1) * sizeof(void *));
+	arr_obj = alloc_array(vm, type + dimension, size);
 	if (!arr_obj)
-	{
-		printf("[%s] malloc fail\n", __FUNCTION__);
 		return NULL;
-	}
-
-	arr_obj->size = size;
 
 	if (dimension < dim->size - 1)
 	{
-		for (i = 0; i < size; i++)
-			arr_obj->ptr[i] = array_create_multi_dimension(dex, vm, dim, dimension + 1);
+		for (i = 0; i < size; i++) {
+			array_refs(arr_obj)[i] = array_create_multi_dimension(dex, vm, dim, dimension + 1, type);
+			if (!array_refs(arr_obj)[i])
+				return NULL;
+			heap_write_barrier(&vm->heap, arr_obj, array_refs(arr_obj)[i]);
+		}
 	}
 
 	return arr_obj;
@@ -331,10 +835,6 @@ int java_lang_reflect_array_new_instance(DexFileFormat *dex, simple_dalvik_vm *v
     load_reg_to(vm, idx_vy, (unsigned char *) &dim_arr_ins_obj);
     dim_arr_obj = (array_obj *)dim_arr_ins_obj->priv_data;
 
-    result_arr = array_create_multi_dimension(dex, vm, dim_arr_obj, 0);
-    if (!result_arr)
-	    return -1;
-
     gen_array_class_name(class_name, sizeof(class_name), cls_obj->name, dim_arr_obj->size);
     if (is_verbose())
 	    printf("Array class name: %s\n", class_name);
@@ -351,11 +851,15 @@ int java_lang_reflect_array_new_instance(DexFileFormat *dex, simple_dalvik_vm *v
 
         memset(result_cls_obj, 0, sizeof(class_obj));
         strncpy(result_cls_obj->name, class_name, strlen(class_name));
-        list_init(&result_cls_obj->class_list);
-        hash_add(&vm->root_set, &result_cls_obj->class_list, hash(result_cls_obj->name));
+        hash_put(&vm->root_set, hash(result_cls_obj->name), result_cls_obj->name, result_cls_obj);
     }
 
-    result_ins_obj = (instance_obj *)malloc(sizeof(instance_obj));
+    result_arr = array_create_multi_dimension(dex, vm, dim_arr_obj, 0, result_cls_obj->name);
+    if (!result_arr)
+	    return -1;
+
+    result_ins_obj = (instance_obj *)heap_alloc(&vm->heap, sizeof(instance_obj),
+            OBJ_INSTANCE, result_cls_obj->name);
     if (!result_ins_obj)
     {
         printf("[%s] instance obj malloc fail\n", __FUNCTION__);
@@ -365,6 +869,7 @@ int java_lang_reflect_array_new_instance(DexFileFormat *dex, simple_dalvik_vm *v
 
     result_ins_obj->cls = result_cls_obj;
     result_ins_obj->priv_data = (void *)result_arr;
+    heap_write_barrier(&vm->heap, result_ins_obj, result_arr);
 
     store_to_bottom_half_result(vm, (unsigned char *)&result_ins_obj);
     if (is_verbose())
@@ -389,6 +894,164 @@ int java_lang_system_currenttimemillis(DexFileFormat *dex, simple_dalvik_vm *vm,
     return 0;
 }
 
+/* The array_obj behind the array reference in register id, or NULL */
+static array_obj *array_arg(simple_dalvik_vm *vm, int id)
+{
+	instance_obj *arr_ins_obj;
+
+	load_reg_to(vm, id, (unsigned char *) &arr_ins_obj);
+	return arr_ins_obj ? (array_obj *) arr_ins_obj->priv_data : NULL;
+}
+
+/* Mark the card of arr if one of its elements [from, to) is young */
+static void array_barrier(vm_heap *heap, array_obj *arr, int from, int to)
+{
+	int i;
+
+	for (i = from; i < to; i++)
+		if (heap_is_young(heap, array_refs(arr)[i])) {
+			heap_write_barrier(heap, arr, array_refs(arr)[i]);
+			return;
+		}
+}
+
+int java_lang_system_arraycopy(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+	invoke_parameters *p = &vm->p;
+	array_obj *src, *dst;
+	int src_pos, dst_pos, length;
+
+	if (is_verbose())
+		printf("call java.lang.System.arraycopy\n");
+
+	src = array_arg(vm, p->reg_idx[0]);
+	src_pos = get_reg_int(vm, p->reg_idx[1]);
+	dst = array_arg(vm, p->reg_idx[2]);
+	dst_pos = get_reg_int(vm, p->reg_idx[3]);
+	length = get_reg_int(vm, p->reg_idx[4]);
+
+	if (!src || !dst)
+	{
+		printf("[%s] null array\n", __FUNCTION__);
+		return -1;
+	}
+	if (src->elem != dst->elem && !(array_holds_refs(src) && array_holds_refs(dst)))
+	{
+		printf("[%s] can't copy [%c to [%c\n", __FUNCTION__, src->elem, dst->elem);
+		return -1;
+	}
+	if (src_pos < 0 || dst_pos < 0 || length < 0 ||
+	    src_pos > src->size - length || dst_pos > dst->size - length)
+	{
+		printf("[%s] Out of boundary: %d+%d of %d to %d of %d\n", __FUNCTION__,
+			src_pos, length, src->size, dst_pos, dst->size);
+		return -1;
+	}
+
+	/* src and dst may be the same array */
+	memmove(dst->data + dst_pos * dst->width, src->data + src_pos * src->width,
+		length * src->width);
+	if (array_holds_refs(dst))
+		array_barrier(&vm->heap, dst, dst_pos, dst_pos + length);
+
+	return 0;
+}
+
+/* fill(array, value) and fill(array, from, to, value) for every array type */
+int java_util_arrays_fill(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+	invoke_parameters *p = &vm->p;
+	array_obj *arr;
+	int from, to;
+	int val_idx;
+	u1 value[8];
+
+	if (is_verbose())
+		printf("call java.util.Arrays.fill\n");
+
+	arr = array_arg(vm, p->reg_idx[0]);
+	if (!arr)
+	{
+		printf("[%s] null array\n", __FUNCTION__);
+		return -1;
+	}
+
+	/* a long or double value takes two registers */
+	if (p->reg_count > (arr->width == 8 && !array_holds_refs(arr) ? 3 : 2))
+	{
+		from = get_reg_int(vm, p->reg_idx[1]);
+		to = get_reg_int(vm, p->reg_idx[2]);
+		val_idx = p->reg_idx[3];
+	}
+	else
+	{
+		from = 0;
+		to = arr->size;
+		val_idx = p->reg_idx[1];
+	}
+	if (from < 0 || from > to || to > arr->size)
+	{
+		printf("[%s] Out of boundary: [%d, %d) of %d\n", __FUNCTION__, from, to, arr->size);
+		return -1;
+	}
+
+	/* narrow values sit in the low bytes of their register */
+	if (arr->width == 8 && !array_holds_refs(arr))
+		load_reg_to_wide(vm, val_idx, value);
+	else
+		load_reg_to(vm, val_idx, value);
+	array_fill(arr, from, to, value);
+	if (array_holds_refs(arr) && from < to)
+		heap_write_barrier(&vm->heap, arr, array_refs(arr)[from]);
+
+	return 0;
+}
+
+/* Elements of reference arrays are equal when they are the same object or
+ * Strings of the same characters; other classes' equals() is not run */
+static int array_refs_equal(array_obj *a, array_obj *b)
+{
+	int i;
+
+	for (i = 0; i < a->size; i++)
+	{
+		String *x = array_refs(a)[i];
+		String *y = array_refs(b)[i];
+
+		if (x == y)
+			continue;
+		if (!is_string(x) || !is_string(y) ||
+		    x->buf_size != y->buf_size || memcmp(x->buf, y->buf, x->buf_size))
+			return 0;
+	}
+	return 1;
+}
+
+int java_util_arrays_equals(DexFileFormat *dex, simple_dalvik_vm *vm, char *type)
+{
+	invoke_parameters *p = &vm->p;
+	array_obj *a, *b;
+	int equal;
+
+	if (is_verbose())
+		printf("call java.util.Arrays.equals\n");
+
+	a = array_arg(vm, p->reg_idx[0]);
+	b = array_arg(vm, p->reg_idx[1]);
+
+	if (a == b)
+		equal = 1;
+	else if (!a || !b || a->size != b->size || a->width != b->width)
+		equal = 0;
+	else if (array_holds_refs(a))
+		equal = array_refs_equal(a, b);
+	else
+		equal = !memcmp(a->data, b->data, a->size * a->width);
+	store_to_bottom_half_result(vm, (unsigned char *) &equal);
+
+	return 0;
+}
+
 class_obj *find_java_class_obj(simple_dalvik_vm *vm, char *name)
 {
     int i = 0;
@@ -398,21 +1061,40 @@ class_obj *find_java_class_obj(simple_dalvik_vm *vm, char *name)
     return NULL;
 }
 
+/* Library classes are not in the VM's root_set, so their static fields
+ * are reported to the collector from here */
+void java_lib_visit_roots(simple_dalvik_vm *vm, gc_slot_func visit)
+{
+    int i = 0;
+    for (i = 0; i < java_lang_clz_size; i++)
+		gc_visit_fields(&vm->heap, clz_table[i].clzobj->fields,
+				clz_table[i].clzobj->field_size, clz_table[i].clzobj->statics, visit);
+}
+
 static java_lang_method method_table[] = {
     {"Ljava/lang/Math;",          "random",   java_lang_math_random},
     {"Ljava/io/PrintStream;",     "println",  java_io_print_stream_println},
+    {"Ljava/io/PrintStream;",     "print",    java_io_print_stream_print},
+    {"Ljava/io/PrintStream;",     "flush",    java_io_print_stream_flush},
     {"Ljava/io/InputStreamReader;", "<init>",   java_io_inputstreamreader_init},
     {"Ljava/io/BufferedReader;", "<init>",   java_io_bufferedreader_init},
     {"Ljava/io/BufferedReader;", "readLine",   java_io_bufferedreader_readline},
     {"Ljava/lang/Long;", "valueOf",   java_lang_long_valueof},
     {"Ljava/lang/Long;", "longValue",   java_lang_long_longvalue},
     {"Ljava/lang/String;", "charAt",   java_lang_string_charat},
+    {"Ljava/lang/String;", "length",   java_lang_string_length},
+    {"Ljava/lang/String;", "hashCode",   java_lang_string_hashcode},
+    {"Ljava/lang/String;", "equals",   java_lang_string_equals},
     {"Ljava/lang/String;", "compareTo",   java_lang_string_compareto},
     {"Ljava/lang/StringBuilder;", "<init>",   java_lang_string_builder_init},
     {"Ljava/lang/StringBuilder;", "append",   java_lang_string_builder_append},
     {"Ljava/lang/StringBuilder;", "toString", java_lang_string_builder_to_string},
+    {"Ljava/lang/StringBuilder;", "length", java_lang_string_builder_length},
     {"Ljava/lang/reflect/Array;", "newInstance", java_lang_reflect_array_new_instance},
     {"Ljava/lang/System;", "currentTimeMillis", java_lang_system_currenttimemillis},
+    {"Ljava/lang/System;", "arraycopy", java_lang_system_arraycopy},
+    {"Ljava/util/Arrays;", "fill", java_util_arrays_fill},
+    {"Ljava/util/Arrays;", "equals", java_util_arrays_equals},
 };
 
 static int java_lang_method_size = sizeof(method_table) / sizeof(java_lang_method);
@@ -10,17 +10,21 @@
 #include "simple_dvm.h"
 
 typedef struct _String {
-	int buf_size;
-    char *buf;
+	int buf_size;	/* bytes of buf, the terminating NUL included */
+    char *buf;	/* follows the String, or the dex string pool if interned */
+	int hash;	/* hashCode(), 0 until it is first asked for */
+	int length;	/* UTF-16 code units of buf */
 } String;
 
 typedef struct _Long {
 	long long val;
 } Long;
 
+/* The characters are kept in a String with room to grow, which
+ * toString() hands out as is; the next append copies them first */
 typedef struct _StringBuilder {
-	int buf_ptr;
-    char buf[1024];
+	String *str;
+	int shared;	/* str was returned by toString() */
 } StringBuilder;
 
 typedef int (*java_lang_lib)(DexFileFormat *dex, simple_dalvik_vm *vm, char*type);
@@ -36,9 +40,14 @@ typedef struct _java_lang_clz {
     class_obj *clzobj;
 } java_lang_clz;
 
+java_lang_method *find_java_lang_method(char *cls_name, char *method_name);
 int invoke_java_lang_library(DexFileFormat *dex, simple_dalvik_vm *vm,
                              char *cls_name, char *method_name, char *type); 
 String* java_lang_string_const_string(DexFileFormat *dex, simple_dalvik_vm *vm, char *c_str, int len);
+String *java_lang_string_intern(DexFileFormat *dex, simple_dalvik_vm *vm, int string_id);
 class_obj *find_java_class_obj(simple_dalvik_vm *vm, char *name);
+void java_lib_visit_roots(simple_dalvik_vm *vm, gc_slot_func visit);
+int java_io_init_stdout(uint size);
+void java_io_flush_stdout();
 
 #endif
@@ -7,7 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "simple_dvm.h"
+#include "java_lib.h"
 
 int main(int argc, char *argv[])
 {
@@ -16,15 +16,37 @@ int main(int argc, char *argv[])
     int x = 0;
 
     memset(&dex, 0, sizeof(DexFileFormat));
-    if (argc < 2) {
-        printf("%s [dex_file] \n", argv[0]);
+    /* -X options come before the dex file */
+    for (x = 1; x < argc && argv[x][0] == '-'; x++) {
+        if (!strncmp(argv[x], "-Xss", 4) && parse_size(argv[x] + 4)) {
+            set_stack_size(parse_size(argv[x] + 4));
+        } else if (!strncmp(argv[x], "-Xmx", 4) && parse_size(argv[x] + 4)) {
+            set_heap_size(parse_size(argv[x] + 4));
+        } else if (!strncmp(argv[x], "-Xmn", 4) && parse_size(argv[x] + 4)) {
+            set_nursery_size(parse_size(argv[x] + 4));
+        } else if (!strcmp(argv[x], "-Xout0")) {
+            set_output_buffer_size(0);
+        } else if (!strncmp(argv[x], "-Xout", 5) && parse_size(argv[x] + 5)) {
+            set_output_buffer_size(parse_size(argv[x] + 5));
+        } else if (!strcmp(argv[x], "-verbose:gc")) {
+            set_gc_verbose(1);
+        } else {
+            printf("invalid option: %s\n", argv[x]);
+            return 1;
+        }
+    }
+    if (argc - x < 1) {
+        printf("%s [-Xss<size>[k|m]] [-Xmx<size>[k|m]] [-Xmn<size>[k|m]] [-Xout<size>[k|m]] [-verbose:gc] [dex_file] \n", argv[0]);
         return 0;
     }
-    if (argc >= 3)
-        set_verbose(atoi(argv[2]));
-    parseDexFile(argv[1], &dex);
+    if (java_io_init_stdout(get_output_buffer_size()) < 0)
+        return 1;
+    if (argc - x >= 2)
+        set_verbose(atoi(argv[x + 1]));
+    parseDexFile(argv[x], &dex);
     if (is_verbose() > 3) printDexFile(&dex);
     simple_dvm_startup(&dex, &vm, "main");
+    java_io_flush_stdout();
 
     freeDex(&dex);
 
@@ -61,11 +61,8 @@ static void parse_type_list(DexFileFormat *dex,
     if (is_verbose() > 3)
         printf("type_list size = %d\n", dex->type_list.size);
     if (dex->type_list.size > 0) {
-        dex->type_list.type_item = malloc(sizeof(type_item) * dex->type_list.size);
+        dex->type_list.type_item = (type_item *) (buf + offset + 4);
         for (i = 0 ; i < dex->type_list.size; i++) {
-            memcpy(&dex->type_list.type_item[i],
-                   buf + offset + 4 + (sizeof(type_item) * i),
-                   sizeof(type_item));
             if (is_verbose() > 3)
                 printf("type_list[%d], type_idx = %d\n", i,
                        dex->type_list.type_item[i].type_idx);
@@ -78,7 +75,6 @@ static void parse_map_item(DexFileFormat *dex,
                            unsigned char *buf, int offset, int index)
 {
     int size_in_bytes = 0;
-    memcpy(&dex->map_list.map_item[index], buf + offset, sizeof(map_item));
     size_in_bytes = 4 + (dex->map_list.map_item[index].size * 2);
     if (is_verbose() > 3) {
         printf("offset = %04x ", offset + sizeof(DexHeader));
@@ -106,7 +102,7 @@ void parse_map_list(DexFileFormat *dex, unsigned char *buf, int offset)
     if (is_verbose() > 3)
         printf("map_list size = %d\n", dex->map_list.size);
     if (dex->map_list.size > 0) {
-        dex->map_list.map_item = malloc(sizeof(map_item) * dex->map_list.size);
+        dex->map_list.map_item = (map_item *) (buf + offset + 4);
         for (i = 0 ; i < dex->map_list.size; i++)
             parse_map_item(dex, buf, offset + 4 + (sizeof(map_item) * i), i);
     }
@@ -11,55 +11,39 @@ void parse_method_ids(DexFileFormat *dex, unsigned char *buf, int offset)
     int i = 0;
     if (is_verbose() > 3)
         printf("parse method ids offset = %04x\n", offset + sizeof(DexHeader));
-    dex->method_id_item = malloc(
-                              sizeof(method_id_item) * dex->header.methodIdsSize);
+    dex->method_id_item = (method_id_item *) (buf + offset);
 
     for (i = 0 ; i < dex->header.methodIdsSize ; i++) {
-        memcpy(&dex->method_id_item[i],
-               buf + i * sizeof(method_id_item) + offset,
-               sizeof(method_id_item));
-
         if (is_verbose() > 3)
             printf(" method[%d], cls_id = %d, proto_id = %d, name_id = %d, %s\n",
                    i,
                    dex->method_id_item[i].class_idx,
                    dex->method_id_item[i].proto_idx,
                    dex->method_id_item[i].name_idx,
-                   dex->string_data_item[dex->method_id_item[i].name_idx].data);
+                   get_string_data(dex, dex->method_id_item[i].name_idx));
     }
 }
 
 method_id_item *get_method_item_by_name(DexFileFormat *dex, int class_idx, const char *name)
 {
-	int i, j;
-	method_id_item *found = NULL;
-
-	for (i = 0; i < dex->header.classDefsSize; i++)
-	{
-		if (dex->class_def_item[i].class_idx == class_idx)
-		{
-			class_data_item *item = &dex->class_data_item[i];
-			int methods_size = item->direct_methods_size;
-			int aggregated_idx = 0;
+	int i, idx, name_idx;
+	class_data_item *item;
+	int aggregated_idx = 0;
 
-			for (j = 0; j < methods_size; j++)
-			{
-				encoded_method *tmp = &item->direct_methods[j];
-				aggregated_idx += tmp->method_idx_diff;
-				method_id_item *item = &dex->method_id_item[aggregated_idx]; 
-				if (strcmp(get_string_data(dex, item->name_idx), name) == 0) 
-				{
-					found = item;
-					break;
-				}
-			}
+	idx = get_class_def_index(dex, class_idx);
+	name_idx = find_string_id(dex, (char *) name);
+	if (idx < 0 || name_idx < 0)
+		return NULL;
 
-			if (found)
-				break;
-		}
+	item = get_class_data_item(dex, idx);
+	for (i = 0; i < item->direct_methods_size; i++)
+	{
+		aggregated_idx += item->direct_methods[i].method_idx_diff;
+		if (dex->method_id_item[aggregated_idx].name_idx == name_idx)
+			return &dex->method_id_item[aggregated_idx];
 	}
 
-	return found;
+	return NULL;
 }
 
 method_id_item *get_method_item(DexFileFormat *dex, int method_id)
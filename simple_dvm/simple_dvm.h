@@ -13,6 +13,7 @@
 #include <time.h>
 #include "list_head.h"
 #include "hash_table.h"
+#include "heap.h"
 
 typedef short u2;
 typedef unsigned int u4;
@@ -43,9 +44,8 @@ typedef struct _type_list {
 
 /* string_ids */
 typedef struct _string_data_item {
-    int index;
-    int uleb128_len;
-    u1  data[255];
+    uint offset;      /* file offset of the NUL terminated MUTF-8 data in the dex image */
+    uint uleb128_len; /* length in UTF-16 code units */
 } string_data_item;
 
 typedef struct _string_ids {
@@ -87,6 +87,10 @@ typedef struct _code_item {
     uint   debug_info_off;
     uint   insns_size;
     ushort *insns;
+    /* pre-decoded instructions, built on first invocation by decode_method() */
+    struct _decoded_insn *decoded;
+    uint   decoded_size;
+    int    *decoded_index; /* insns code unit -> decoded index, -1 if none */
     /*
     ushort padding;
     try_item
@@ -127,6 +131,7 @@ typedef struct _class_data_item {
     encoded_field *instance_fields;
     encoded_method *direct_methods;
     encoded_method *virtual_methods;
+    int loaded; /* parsed from the dex image, see get_class_data_item() */
 } class_data_item;
 
 typedef struct _DexHeader {
@@ -159,6 +164,7 @@ typedef struct DexFileFormat {
     DexHeader header;
     string_ids       *string_ids;
     string_data_item *string_data_item;
+    struct hash_table string_index; /* string contents -> string_id */
     type_id_item     *type_id_item;
     proto_id_item    *proto_id_item;
     type_list        *proto_type_list;
@@ -166,9 +172,17 @@ typedef struct DexFileFormat {
     method_id_item   *method_id_item;
     class_def_item   *class_def_item;
     class_data_item  *class_data_item;
+    int              *class_def_index; /* type_idx -> class_defs index, -1 if not defined */
+    encoded_method   **method_index;   /* method_id -> encoded_method, NULL if not defined */
     map_list         map_list;
     type_list        type_list;
     u1               *data;
+    /* the whole dex file; id tables, strings and insns point into it */
+    u1               *image;
+    uint             image_size;
+    int              image_mapped; /* image is mmap()ed rather than malloc()ed */
+    uint             class_data_loaded;
+    uint             code_items_loaded;
 } DexFileFormat;
 
 /* Dex File Parser */
@@ -181,6 +195,8 @@ void parse_map_list(DexFileFormat *dex, unsigned char *buf, int offset);
 /* String ids parser */
 void parse_string_ids(DexFileFormat *dex, unsigned char *buf, int offset);
 char *get_string_data(DexFileFormat *dex, int string_id);
+int get_string_length(DexFileFormat *dex, int string_id);
+int find_string_id(DexFileFormat *dex, char *str);
 
 /* type_ids parser */
 void parse_type_ids(DexFileFormat *dex, unsigned char *buf, int offset);
@@ -206,6 +222,11 @@ method_id_item *get_method_item_by_name(DexFileFormat *dex, int class_idx, const
 
 /* class defs parser */
 void parse_class_defs(DexFileFormat *dex, unsigned char *buf, int offset);
+int get_class_def_index(DexFileFormat *dex, int type_id);
+class_data_item *get_class_data_item(DexFileFormat *dex, int index);
+code_item *get_code_item(DexFileFormat *dex, encoded_method *method);
+encoded_method *get_encoded_method(DexFileFormat *dex, int method_id);
+void print_class_load_stats(DexFileFormat *dex);
 
 int get_uleb128_len(unsigned char *buf, int offset, int *size);
 
@@ -216,78 +237,202 @@ typedef struct _invoke_parameters {
     int reg_idx[5]; // 0-5 map C-G
 } invoke_parameters;
 
-/* Dalvik VM Register Bank */
-typedef struct _simple_dvm_register {
-    u1 data[4];
-} simple_dvm_register;
+/* Dalvik VM Register Bank
+ * A wide value lives in vx (low word) and vx+1 (high word), so a
+ * register pair reads and writes as one 64-bit value.
+ */
+typedef u4 simple_dvm_register;
+
+/* Every invoked method gets a window of registers_size registers on top of
+ * the register stack; vm->regs points at the window of the running method.
+ */
+#define REG_STACK_INIT_SIZE 256
+
+/* Frame record of an active method, pushed on vm->frames by an invoke and
+ * popped by its return; the caller's record is the one right below it.
+ */
+typedef struct _vm_frame {
+    encoded_method *method;
+    uint return_pc; /* where the caller resumes */
+    uint regs;      /* offset of the register window in reg_stack */
+} vm_frame;
+
+#define FRAME_STACK_INIT_SIZE 64
+
+/* Bytes of frame records and register windows a thread may use before
+ * it throws StackOverflowError; set with -Xss
+ */
+#define DEFAULT_STACK_SIZE (512 * 1024)
+#define DEFAULT_OUTPUT_BUFFER_SIZE (64 * 1024)
 
 typedef struct _simple_dalvik_vm {
-    u1 heap[8192];
     u1 object_ref[4];
-    simple_dvm_register regs[32];
+    simple_dvm_register *regs;
+    simple_dvm_register *reg_stack;
+    uint reg_stack_size; /* capacity, in registers */
+    uint reg_top;        /* first register not owned by any frame */
     invoke_parameters p;
-    u1 result[8];
+    u4 result[2]; /* [0]: 32-bit result or low word, [1]: high word */
     uint pc;
-    u1 *fp;
-    u1 *sp;
-	u1 returned;
+    vm_frame *frames;
+    uint frame_count;    /* call depth */
+    uint frame_capacity;
+    vm_frame *fp;        /* running frame, frames[frame_count - 1] */
 	struct hash_table root_set;
+	struct _class_obj **type_class_obj; /* type_id -> class_obj cache */
+	int type_class_obj_size;
+	struct _String **strings; /* string_id -> interned const-string */
+	int string_count;
+	vm_heap heap;
 } simple_dalvik_vm;
 
-typedef struct _obj_field {
-	char name[255];
-	char type[255];
-	int size;
-	union {
-		unsigned int idata;
-		unsigned char cdata;
-		unsigned short sdata;
-		unsigned long long ldata;
-		void *vdata;
-		float fdata;
-		double ddata;
-	} data;
-} obj_field;
+/*
+ * A field declared by a class, described once for all its instances.
+ * The value is kept in a slot of size bytes at offset in the field data
+ * of an instance, or in the statics of the class for a static field.
+ */
+typedef struct _field_info {
+	char *name;	/* "Lclass;.name" for instance fields, "name" for static ones */
+	char *type;	/* descriptor */
+	uint offset;
+	uint size;	/* 1, 2, 4 or 8 bytes, by type */
+} field_info;
 
 typedef struct _vtable_item {
-	char name[255];
 	encoded_method *method;
 	uint method_id;
 } vtable_item;
 
 typedef struct _class_obj {
 	char name[255];
-	struct list_head class_list;
-	obj_field *fields;
+	field_info *fields;	/* static fields */
 	int field_size;
+	u1 *statics;		/* slots of the static fields */
+	field_info *ifields;	/* instance fields, those of the superclasses first */
+	int ifield_size;
+	uint instance_size;	/* bytes of instance field slots */
 	struct _class_obj *parent;
 	vtable_item *vtable;
 	int vtable_size;
+	/* vtable slot of method_id vtable_map_base + i, -1 if not virtual */
+	int *vtable_map;
+	uint vtable_map_base;
+	int vtable_map_size;
 } class_obj;
 
+/* The field slots of an instance, laid out by its class, follow the
+ * instance_obj header */
 typedef struct _instance_obj {
 	class_obj *cls;
-	obj_field *fields;
-	int field_size;
 	void *priv_data;
 } instance_obj;
 
+static inline u1 *instance_data(instance_obj *obj)
+{
+	return (u1 *) (obj + 1);
+}
+
+/* Elements are stored unboxed at the width of their type: 1 byte for
+ * [Z and [B, 2 for [C and [S, 4 for [I and [F, 8 for [J and [D and a
+ * pointer for references */
 typedef struct _array_obj {
-	int size;
-	void *ptr[1];
+	int size;	/* elements */
+	u1 width;	/* bytes per element */
+	char elem;	/* descriptor character of the element type */
+	u2 reserved;	/* keeps data 8-byte aligned */
+	u1 data[];
 } array_obj;
 
-/* convert to int ok */
-void load_reg_to(simple_dalvik_vm *vm, int id, unsigned char *ptr);
-void load_reg_to_double(simple_dalvik_vm *vm, int id, unsigned char *ptr);
+static inline void **array_refs(array_obj *arr)
+{
+	return (void **) arr->data;
+}
+
+static inline int array_holds_refs(array_obj *arr)
+{
+	return arr->elem == 'L' || arr->elem == '[';
+}
+
+/* Typed register accessors; memcpy keeps them free of aliasing issues
+ * and compiles down to a single load or store */
+static inline int get_reg_int(simple_dalvik_vm *vm, int id)
+{
+    return (int) vm->regs[id];
+}
+
+static inline void set_reg_int(simple_dalvik_vm *vm, int id, int value)
+{
+    vm->regs[id] = (u4) value;
+}
+
+static inline float get_reg_float(simple_dalvik_vm *vm, int id)
+{
+    float value;
+    memcpy(&value, &vm->regs[id], sizeof(value));
+    return value;
+}
+
+static inline void set_reg_float(simple_dalvik_vm *vm, int id, float value)
+{
+    memcpy(&vm->regs[id], &value, sizeof(value));
+}
+
+static inline long long get_reg_long(simple_dalvik_vm *vm, int id)
+{
+    long long value;
+    memcpy(&value, &vm->regs[id], sizeof(value));
+    return value;
+}
+
+static inline void set_reg_long(simple_dalvik_vm *vm, int id, long long value)
+{
+    memcpy(&vm->regs[id], &value, sizeof(value));
+}
+
+static inline double get_reg_double(simple_dalvik_vm *vm, int id)
+{
+    double value;
+    memcpy(&value, &vm->regs[id], sizeof(value));
+    return value;
+}
+
+static inline void set_reg_double(simple_dalvik_vm *vm, int id, double value)
+{
+    memcpy(&vm->regs[id], &value, sizeof(value));
+}
+
+/* Untyped copies between a register (pair) and memory */
+static inline void load_reg_to(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+{
+    memcpy(ptr, &vm->regs[id], 4);
+}
+
+static inline void load_reg_to_wide(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+{
+    memcpy(ptr, &vm->regs[id], 8);
+}
+
+static inline void store_to_reg(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+{
+    memcpy(&vm->regs[id], ptr, 4);
+}
+
+static inline void store_wide_to_reg(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+{
+    memcpy(&vm->regs[id], ptr, 8);
+}
+
 void load_result_to_double(simple_dalvik_vm *vm, unsigned char *ptr);
 void load_field_to(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name);
 void load_field_to_wide(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name);
 void load_static_field_to(simple_dalvik_vm *vm, int val_id, char *class_name, char *field_name);
 void load_static_field_to_wide(simple_dalvik_vm *vm, int val_id, char *class_name, char *field_name);
+uint field_slot_size(const char *type);
+array_obj *alloc_array(simple_dalvik_vm *vm, const char *type, int size);
+void array_fill(array_obj *arr, int from, int to, const void *value);
+field_info *find_instance_field(class_obj *cls, char *field_name);
+field_info *find_static_field(class_obj *obj_itr, char *field_name, u1 **slot);
 
-void store_to_reg(simple_dalvik_vm *vm, int id, unsigned char *ptr);
-void store_double_to_reg(simple_dalvik_vm *vm, int id, unsigned char *ptr);
 void store_double_to_result(simple_dalvik_vm *vm, unsigned char *ptr);
 void store_to_field(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name);
 void store_to_field_wide(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name);
@@ -298,7 +443,7 @@ void store_to_bottom_half_result(simple_dalvik_vm *vm, unsigned char *ptr);
 void printRegs(simple_dalvik_vm *vm);
 void printInsFields(instance_obj *obj);
 void printStaticFields(class_obj *cls);
-void printVTable(class_obj *obj);
+void printVTable(DexFileFormat *dex, class_obj *obj);
 void dump_array(instance_obj *array);
 void dump_array_dimension(array_obj *array, int dimension);
 void dump_array_wide(instance_obj *array);
@@ -322,7 +467,7 @@ int cmp_reg_z(simple_dalvik_vm *vm, int id, CMP_TYPE cmp_type);
 int cmp_reg_long(simple_dalvik_vm *vm, int id1, int id2, CMP_TYPE cmp_type);
 
 void simple_dvm_startup(DexFileFormat *dex, simple_dalvik_vm *vm, char *entry);
-void runMethod(DexFileFormat *dex, simple_dalvik_vm *vm, encoded_method *m);
+void runMethod(DexFileFormat *dex, simple_dalvik_vm *vm);
 
 void freeDex(DexFileFormat *dex);
 
@@ -335,9 +480,84 @@ typedef struct _byteCode {
     opCodeFunc func;
 } byteCode;
 
+/* pseudo opcodes of the decoded instruction stream */
+#define OP_END                0x100
+/* quickened instance field accesses, by slot width */
+#define OP_IGET_QUICK         0x101
+#define OP_IGET_WIDE_QUICK    0x102
+#define OP_IGET_BOOLEAN_QUICK 0x103
+#define OP_IGET_BYTE_QUICK    0x104
+#define OP_IGET_CHAR_QUICK    0x105
+#define OP_IGET_SHORT_QUICK   0x106
+#define OP_IPUT_QUICK         0x107
+#define OP_IPUT_WIDE_QUICK    0x108
+#define OP_IPUT_OBJECT_QUICK  0x109
+#define OP_IPUT_BYTE_QUICK    0x10a	/* iput-boolean and iput-byte */
+#define OP_IPUT_SHORT_QUICK   0x10b	/* iput-char and iput-short */
+/* quickened static field accesses, in the same order */
+#define OP_SGET_QUICK         0x10c
+#define OP_SGET_WIDE_QUICK    0x10d
+#define OP_SGET_BOOLEAN_QUICK 0x10e
+#define OP_SGET_BYTE_QUICK    0x10f
+#define OP_SGET_CHAR_QUICK    0x110
+#define OP_SGET_SHORT_QUICK   0x111
+#define OP_SPUT_QUICK         0x112
+#define OP_SPUT_WIDE_QUICK    0x113
+#define OP_SPUT_OBJECT_QUICK  0x114
+#define OP_SPUT_BYTE_QUICK    0x115
+#define OP_SPUT_SHORT_QUICK   0x116
+#define OP_MAX                0x117
+
+/* One instruction of code_item.insns with its operands unpacked */
+typedef struct _decoded_insn {
+    opCodeFunc func;
+    uint   pc;      /* byte offset of the instruction in insns */
+    ushort opcode;
+    ushort va;
+    ushort vb;
+    ushort vc;
+    int    literal; /* field slot offset once an iget/iput is quickened */
+    int    target;  /* decoded index of the branch target */
+    void   *data;   /* field slot of a quickened sget/sput */
+} decoded_insn;
+
+/* Per call site cache of invoke-virtual targets, by receiver class */
+#define INLINE_CACHE_SIZE 4
+
+typedef struct _inline_cache {
+    struct _java_lang_method *library; /* the callee is implemented by java_lib */
+    char *library_type; /* type of its first parameter, as java_lib expects */
+    int  size;
+    uint hits;
+    uint misses;
+    struct {
+        class_obj *cls;
+        encoded_method *method;
+    } entry[INLINE_CACHE_SIZE];
+} inline_cache;
+
+int decode_method(encoded_method *m);
+void print_inline_cache_stats(DexFileFormat *dex);
+
 int is_verbose();
 int enable_verbose();
 int disable_verbose();
 int set_verbose(int l);
+uint get_stack_size();
+int set_stack_size(uint size);
+uint parse_size(const char *str);
+uint get_heap_size();
+int set_heap_size(uint size);
+uint get_nursery_size();
+int set_nursery_size(uint size);
+uint get_output_buffer_size();
+int set_output_buffer_size(uint size);
+int is_gc_verbose();
+int set_gc_verbose(int l);
+
+/* gc.c */
+typedef void (*gc_slot_func)(vm_heap *heap, void **slot);
+void gc_visit_fields(vm_heap *heap, field_info *fields, int size, u1 *data, gc_slot_func visit);
+int gc_collect(simple_dalvik_vm *vm);
 
 #endif
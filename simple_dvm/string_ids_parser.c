@@ -9,29 +9,32 @@
 static void parse_string_data_item(DexFileFormat *dex,
                                    unsigned char *buf, int offset, int index)
 {
-    int i = 0;
     int size = 0;
-    int len = 0;
     if (is_verbose() > 3)
         printf("parse string data item offset = %04x ",
                offset + sizeof(DexHeader));
-    memset(&dex->string_data_item[index], 0, sizeof(string_data_item));
-    dex->string_data_item[index].index = index;
     dex->string_data_item[index].uleb128_len =
         get_uleb128_len(buf, offset , &size) ;
-
-    strncpy(dex->string_data_item[index].data,
-            buf + offset + size,
-            dex->string_data_item[index].uleb128_len);
+    dex->string_data_item[index].offset = offset + size + sizeof(DexHeader);
     if (is_verbose() > 3) {
         printf("str[%2d], len = %4d, ",
-               dex->string_data_item[index].index,
+               index,
                dex->string_data_item[index].uleb128_len
               );
-        printf("data = ");
-        for (i = 0; i < dex->string_data_item[index].uleb128_len; i++)
-            printf("%c", dex->string_data_item[index].data[i]);
-        printf("\n");
+        printf("data = %s\n", get_string_data(dex, index));
+    }
+}
+
+/* Intern the string pool; strings in a dex are unique */
+static void build_string_index(DexFileFormat *dex)
+{
+    int i = 0;
+
+    hash_init(&dex->string_index, hash_str_eq);
+    for (i = 0 ; i < dex->header.stringIdsSize ; i++) {
+        char *str = get_string_data(dex, i);
+
+        hash_put(&dex->string_index, hash(str), str, (void *) (long) i);
     }
 }
 
@@ -40,17 +43,24 @@ void parse_string_ids(DexFileFormat *dex, unsigned char *buf, int offset)
     int i = 0;
     if (is_verbose() > 3)
         printf("parse string ids offset = %04x\n", offset + sizeof(DexHeader));
-    dex->string_ids = malloc(
-                          sizeof(string_ids) * dex->header.stringIdsSize);
+    dex->string_ids = (string_ids *) (buf + offset);
     dex->string_data_item = malloc(
                                 sizeof(string_data_item) * dex->header.stringIdsSize);
     for (i = 0 ; i < dex->header.stringIdsSize ; i++) {
-        memcpy(&dex->string_ids[i].string_data_off,
-               buf + i * 4 + offset, 4);
         parse_string_data_item(dex, buf,
                                dex->string_ids[i].string_data_off - sizeof(dex->header),
                                i);
     }
+    build_string_index(dex);
+}
+
+int find_string_id(DexFileFormat *dex, char *str)
+{
+    void *id = NULL;
+
+    if (!hash_lookup(&dex->string_index, hash(str), str, &id))
+        return -1;
+    return (int) (long) id;
 }
 
 static string_data_item *get_string_data_item(DexFileFormat *dex, int string_id)
@@ -64,6 +74,15 @@ char *get_string_data(DexFileFormat *dex, int string_id)
 {
     string_data_item *s = get_string_data_item(dex, string_id);
     if (s != 0)
-        return s->data;
+        return (char *) dex->image + s->offset;
+    return 0;
+}
+
+/* Length of the string in UTF-16 code units, as recorded in the dex */
+int get_string_length(DexFileFormat *dex, int string_id)
+{
+    string_data_item *s = get_string_data_item(dex, string_id);
+    if (s != 0)
+        return s->uleb128_len;
     return 0;
 }
@@ -34,107 +34,248 @@ int set_verbose(int l)
     return 0;
 }
 
-void load_reg_to(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+static uint stack_size = DEFAULT_STACK_SIZE;
+
+uint get_stack_size()
 {
-    simple_dvm_register *r = &vm->regs[id];
-    ptr[0] = r->data[0];
-    ptr[1] = r->data[1];
-    ptr[2] = r->data[2];
-    ptr[3] = r->data[3];
+    return stack_size;
 }
 
-void load_reg_to_double(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+int set_stack_size(uint size)
 {
-    simple_dvm_register *r = &vm->regs[id];
-    ptr[0] = r->data[2];
-    ptr[1] = r->data[3];
-    ptr[2] = r->data[0];
-    ptr[3] = r->data[1];
+    stack_size = size;
+    return 0;
 }
-void load_result_to_double(simple_dalvik_vm *vm, unsigned char *ptr)
+
+static uint heap_size = DEFAULT_HEAP_SIZE;
+
+uint get_heap_size()
 {
-    ptr[0] = vm->result[2];
-    ptr[1] = vm->result[3];
-    ptr[2] = vm->result[0];
-    ptr[3] = vm->result[1];
-    ptr[4] = vm->result[6];
-    ptr[5] = vm->result[7];
-    ptr[6] = vm->result[4];
-    ptr[7] = vm->result[5];
+    return heap_size;
 }
 
-void store_double_to_result(simple_dalvik_vm *vm, unsigned char *ptr)
+int set_heap_size(uint size)
 {
-    vm->result[0] = ptr[2];
-    vm->result[1] = ptr[3];
-    vm->result[2] = ptr[0];
-    vm->result[3] = ptr[1];
-    vm->result[4] = ptr[6];
-    vm->result[5] = ptr[7];
-    vm->result[6] = ptr[4];
-    vm->result[7] = ptr[5];
+    heap_size = size;
+    return 0;
 }
 
-void store_to_bottom_half_result(simple_dalvik_vm *vm, unsigned char *ptr)
+static uint nursery_size = DEFAULT_NURSERY_SIZE;
+
+uint get_nursery_size()
+{
+    return nursery_size;
+}
+
+int set_nursery_size(uint size)
+{
+    nursery_size = size;
+    return 0;
+}
+
+static uint output_buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE;
+
+uint get_output_buffer_size()
+{
+    return output_buffer_size;
+}
+
+int set_output_buffer_size(uint size)
+{
+    output_buffer_size = size;
+    return 0;
+}
+
+static int gc_verbose_flag = 0;
+
+int is_gc_verbose()
+{
+    return gc_verbose_flag;
+}
+
+int set_gc_verbose(int l)
+{
+    gc_verbose_flag = l;
+    return 0;
+}
+
+/*
+ * Parse a size such as "512k" or "4m" the way -Xss/-Xmx do; returns 0 for
+ * a malformed size
+ */
+uint parse_size(const char *str)
+{
+    char *end;
+    unsigned long size = strtoul(str, &end, 10);
+
+    if (end == str)
+        return 0;
+    switch (*end) {
+    case 'k': case 'K':
+        size *= 1024;
+        end++;
+        break;
+    case 'm': case 'M':
+        size *= 1024 * 1024;
+        end++;
+        break;
+    }
+    return *end ? 0 : (uint) size;
+}
+
+void load_result_to_double(simple_dalvik_vm *vm, unsigned char *ptr)
 {
-    vm->result[4] = ptr[0];
-    vm->result[5] = ptr[1];
-    vm->result[6] = ptr[2];
-    vm->result[7] = ptr[3];
+    memcpy(ptr, vm->result, 8);
 }
 
-void store_double_to_reg(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+void store_double_to_result(simple_dalvik_vm *vm, unsigned char *ptr)
 {
-    simple_dvm_register *r = &vm->regs[id];
-    r->data[0] = ptr[2];
-    r->data[1] = ptr[3];
-    r->data[2] = ptr[0];
-    r->data[3] = ptr[1];
+    memcpy(vm->result, ptr, 8);
 }
 
-void store_to_reg(simple_dalvik_vm *vm, int id, unsigned char *ptr)
+void store_to_bottom_half_result(simple_dalvik_vm *vm, unsigned char *ptr)
 {
-    simple_dvm_register *r = &vm->regs[id];
-    r->data[0] = ptr[0];
-    r->data[1] = ptr[1];
-    r->data[2] = ptr[2];
-    r->data[3] = ptr[3];
+    memcpy(&vm->result[0], ptr, 4);
 }
 
 void move_top_half_result_to_reg(simple_dalvik_vm *vm, int id)
 {
-    simple_dvm_register *r = &vm->regs[id];
-    r->data[0] = vm->result[0];
-    r->data[1] = vm->result[1];
-    r->data[2] = vm->result[2];
-    r->data[3] = vm->result[3];
+    vm->regs[id] = vm->result[1];
 }
 
 void move_bottom_half_result_to_reg(simple_dalvik_vm *vm, int id)
 {
-    simple_dvm_register *r = &vm->regs[id];
-    r->data[0] = vm->result[4];
-    r->data[1] = vm->result[5];
-    r->data[2] = vm->result[6];
-    r->data[3] = vm->result[7];
+    vm->regs[id] = vm->result[0];
 }
 
 void move_reg_to_top_half_result(simple_dalvik_vm *vm, int id)
 {
-    simple_dvm_register *r = &vm->regs[id];
-    vm->result[0] = r->data[0];
-    vm->result[1] = r->data[1];
-    vm->result[2] = r->data[2];
-    vm->result[3] = r->data[3];
+    vm->result[1] = vm->regs[id];
 }
 
 void move_reg_to_bottom_half_result(simple_dalvik_vm *vm, int id)
 {
-    simple_dvm_register *r = &vm->regs[id];
-    vm->result[4] = r->data[0];
-    vm->result[5] = r->data[1];
-    vm->result[6] = r->data[2];
-    vm->result[7] = r->data[3];
+    vm->result[0] = vm->regs[id];
+}
+
+/*
+ * Bytes of the slot holding a field of the given type: references and
+ * 32-bit values take a word, longs and doubles two, the rest their size
+ */
+uint field_slot_size(const char *type)
+{
+	switch (type[0]) {
+	case 'J':
+	case 'D':
+		return 8;
+	case 'I':
+	case 'F':
+		return 4;
+	case 'C':
+	case 'S':
+		return 2;
+	case 'Z':
+	case 'B':
+		return 1;
+	default:
+		return sizeof(void *);
+	}
+}
+
+/*
+ * Allocate the array_obj of "size" elements of array type "type", like
+ * "[I" or "[[Ljava/lang/String;", zero-filled
+ */
+array_obj *alloc_array(simple_dalvik_vm *vm, const char *type, int size)
+{
+	array_obj *arr_obj;
+	uint width = field_slot_size(type + 1);
+
+	if (size < 0)
+	{
+		printf("[%s] negative array size %d of %s\n", __FUNCTION__, size, type);
+		return NULL;
+	}
+	/* size * width must not wrap around; no bigger array can fit anyway */
+	if (vm->heap.limit < sizeof(array_obj) ||
+		(uint) size > (vm->heap.limit - sizeof(array_obj)) / width)
+	{
+		printf("[%s] array obj of %d elements exceeds the heap\n", __FUNCTION__, size);
+		return NULL;
+	}
+
+	arr_obj = (array_obj *)heap_alloc(&vm->heap, sizeof(array_obj) + size * width, OBJ_ARRAY, type);
+	if (!arr_obj)
+	{
+		printf("[%s] array obj malloc fail\n", __FUNCTION__);
+		return NULL;
+	}
+
+	arr_obj->size = size;
+	arr_obj->width = width;
+	arr_obj->elem = type[1];
+
+	return arr_obj;
+}
+
+/*
+ * Set elements [from, to) of arr to the element value points to.  The
+ * filled run is doubled with memcpy, so the bulk of the work is done by
+ * the C library's block copy at memory bandwidth.
+ */
+void array_fill(array_obj *arr, int from, int to, const void *value)
+{
+	u1 *start = arr->data + from * arr->width;
+	uint total = (to - from) * arr->width;
+	uint done;
+
+	if (to <= from)
+		return;
+	if (arr->width == 1)
+	{
+		memset(start, *(const u1 *)value, total);
+		return;
+	}
+
+	memcpy(start, value, arr->width);
+	for (done = arr->width; done < total; done *= 2)
+		memcpy(start + done, start, done < total - done ? done : total - done);
+}
+
+/* Load a 32-bit or narrower slot to register "id", extending it by type */
+static void load_slot_to_reg(simple_dalvik_vm *vm, int id, field_info *field, u1 *slot)
+{
+	unsigned short c;
+	short s;
+
+	switch (field->type[0]) {
+	case 'Z':
+		set_reg_int(vm, id, *slot);
+		break;
+	case 'B':
+		set_reg_int(vm, id, (signed char) *slot);
+		break;
+	case 'C':
+		memcpy(&c, slot, 2);
+		set_reg_int(vm, id, c);
+		break;
+	case 'S':
+		memcpy(&s, slot, 2);
+		set_reg_int(vm, id, s);
+		break;
+	default:
+		store_to_reg(vm, id, slot);
+		break;
+	}
+}
+
+/* Store register "id" to a 32-bit or narrower slot, truncating it */
+static void store_reg_to_slot(simple_dalvik_vm *vm, int id, field_info *field, u1 *slot)
+{
+	unsigned char value[4];
+
+	load_reg_to(vm, id, value);
+	memcpy(slot, value, field->size < 4 ? field->size : 4);
 }
 
 /*
@@ -144,26 +285,16 @@ void move_reg_to_bottom_half_result(simple_dalvik_vm *vm, int id)
 void load_field_to(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name)
 {
     instance_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
 
     load_reg_to(vm, obj_id, (unsigned char *) &obj); 
-    for (i = 0; i < obj->field_size; i++)
-    {
-        if (!strncmp(field_name, obj->fields[i].name, strlen(field_name)))
-		{
-			field = &obj->fields[i];
-			break;
-		}
-	} 
+    field = find_instance_field(obj->cls, field_name);
     if (!field)
     {
        printf("%s: no field found: %s\n", __FUNCTION__, field_name);
 	   return;
     } 
-	ptr = (unsigned char *) &field->data;
-	store_to_reg(vm, val_id, ptr); 
+	load_slot_to_reg(vm, val_id, field, instance_data(obj) + field->offset);
 }
 
 /*
@@ -173,30 +304,40 @@ void load_field_to(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_nam
 void load_field_to_wide(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name)
 {
     instance_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
 
     load_reg_to(vm, obj_id, (unsigned char *) &obj); 
-    for (i = 0; i < obj->field_size; i++)
-    {
-        if (!strncmp(field_name, obj->fields[i].name, strlen(field_name)))
-		{
-			field = &obj->fields[i];
-			break;
-		}
-	} 
+    field = find_instance_field(obj->cls, field_name);
     if (!field)
     {
        printf("%s: no field found: %s\n", __FUNCTION__, field_name);
 	   return;
     } 
-	ptr = (unsigned char *) &field->data;
-    store_double_to_reg(vm, val_id, ptr + 4);
-    store_double_to_reg(vm, val_id + 1, ptr);
+    store_wide_to_reg(vm, val_id, instance_data(obj) + field->offset);
+}
+
+/*
+ * Return the instance field "field_name" of cls, or NULL.  Superclass
+ * fields come first and keep their slots, so a field is at the same
+ * offset in every instance of its declaring class and of the subclasses.
+ */
+field_info *find_instance_field(class_obj *cls, char *field_name)
+{
+	int i;
+
+	for (i = 0; i < cls->ifield_size; i++)
+	{
+		if (!strcmp(field_name, cls->ifields[i].name))
+			return &cls->ifields[i];
+	}
+	return NULL;
 }
 
-obj_field *find_static_field(class_obj *obj_itr, char *field_name)
+/*
+ * Return the static field "field_name" of obj_itr or of its superclasses,
+ * or NULL; *slot is set to where its value is kept.
+ */
+field_info *find_static_field(class_obj *obj_itr, char *field_name, u1 **slot)
 {
 	int i;
 	do {
@@ -204,6 +345,7 @@ obj_field *find_static_field(class_obj *obj_itr, char *field_name)
 		{
 			if (!strcmp(field_name, obj_itr->fields[i].name))
 			{
+				*slot = obj_itr->statics + obj_itr->fields[i].offset;
 				return &obj_itr->fields[i];
 			}
 		}
@@ -218,9 +360,8 @@ class_obj *find_class_obj(simple_dalvik_vm *vm, char *name);
 void load_static_field_to(simple_dalvik_vm *vm, int val_id, char *class_name, char *field_name)
 {
 	class_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
+	u1 *slot;
 
 	obj = find_class_obj(vm, class_name);
 	if (!obj)
@@ -230,7 +371,7 @@ void load_static_field_to(simple_dalvik_vm *vm, int val_id, char *class_name, ch
 		return;
 	}
 
-	field = find_static_field(obj, field_name);
+	field = find_static_field(obj, field_name, &slot);
 
 	if (!field)
 	{
@@ -239,8 +380,7 @@ void load_static_field_to(simple_dalvik_vm *vm, int val_id, char *class_name, ch
 		return;
 	}
 
-	ptr = (unsigned char *) &field->data;
-	store_to_reg(vm, val_id, ptr);
+	load_slot_to_reg(vm, val_id, field, slot);
 }
 
 /*
@@ -249,9 +389,8 @@ void load_static_field_to(simple_dalvik_vm *vm, int val_id, char *class_name, ch
 void load_static_field_to_wide(simple_dalvik_vm *vm, int val_id, char *class_name, char *field_name)
 {
 	class_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
+	u1 *slot;
 
 	obj = find_class_obj(vm, class_name);
 	if (!obj)
@@ -260,7 +399,7 @@ void load_static_field_to_wide(simple_dalvik_vm *vm, int val_id, char *class_nam
 		return;
 	}
 
-	field = find_static_field(obj, field_name);
+	field = find_static_field(obj, field_name, &slot);
 
 	if (!field)
 	{
@@ -268,9 +407,7 @@ void load_static_field_to_wide(simple_dalvik_vm *vm, int val_id, char *class_nam
 		return;
 	}
 
-	ptr = (unsigned char *) &field->data;
-	store_double_to_reg(vm, val_id, ptr + 4);
-	store_double_to_reg(vm, val_id + 1, ptr);
+	store_wide_to_reg(vm, val_id, slot);
 }
 
 /*
@@ -279,9 +416,8 @@ void load_static_field_to_wide(simple_dalvik_vm *vm, int val_id, char *class_nam
 void store_to_static_field(simple_dalvik_vm *vm, int val_id, char *class_name, char *field_name)
 {
 	class_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
+	u1 *slot;
 
 	obj = find_class_obj(vm, class_name);
 	if (!obj)
@@ -290,7 +426,7 @@ void store_to_static_field(simple_dalvik_vm *vm, int val_id, char *class_name, c
 		return;
 	}
 
-	field = find_static_field(obj, field_name);
+	field = find_static_field(obj, field_name, &slot);
 
 	if (!field)
 	{
@@ -298,8 +434,7 @@ void store_to_static_field(simple_dalvik_vm *vm, int val_id, char *class_name, c
 		return;
 	}
 
-	ptr = (unsigned char *) &field->data;
-	load_reg_to(vm, val_id, ptr);
+	store_reg_to_slot(vm, val_id, field, slot);
 }
 
 /*
@@ -308,9 +443,8 @@ void store_to_static_field(simple_dalvik_vm *vm, int val_id, char *class_name, c
 void store_to_static_field_wide(simple_dalvik_vm *vm, int val_id, char *class_name, char *field_name)
 {
 	class_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
+	u1 *slot;
 
 	obj = find_class_obj(vm, class_name);
 	if (!obj)
@@ -319,7 +453,7 @@ void store_to_static_field_wide(simple_dalvik_vm *vm, int val_id, char *class_na
 		return;
 	}
 
-	field = find_static_field(obj, field_name);
+	field = find_static_field(obj, field_name, &slot);
 
 	if (!field)
 	{
@@ -327,9 +461,7 @@ void store_to_static_field_wide(simple_dalvik_vm *vm, int val_id, char *class_na
 		return;
 	}
 
-	ptr = (unsigned char *) &field->data;
-	load_reg_to_double(vm, val_id, ptr + 4);
-	load_reg_to_double(vm, val_id + 1, ptr);
+	load_reg_to_wide(vm, val_id, slot);
 }
 
 /*
@@ -339,26 +471,16 @@ void store_to_static_field_wide(simple_dalvik_vm *vm, int val_id, char *class_na
 void store_to_field(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name)
 {
     instance_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
 
     load_reg_to(vm, obj_id, (unsigned char *) &obj); 
-    for (i = 0; i < obj->field_size; i++)
-    {
-        if (!strncmp(field_name, obj->fields[i].name, strlen(field_name)))
-		{
-			field = &obj->fields[i];
-			break;
-		}
-	} 
+    field = find_instance_field(obj->cls, field_name);
     if (!field)
     {
        printf("%s: no field found: %s\n", __FUNCTION__, field_name);
 	   return;
     } 
-	ptr = (unsigned char *) &field->data;
-	load_reg_to(vm, val_id, ptr); 
+	store_reg_to_slot(vm, val_id, field, instance_data(obj) + field->offset);
 }
 
 /*
@@ -368,35 +490,26 @@ void store_to_field(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_na
 void store_to_field_wide(simple_dalvik_vm *vm, int val_id, int obj_id, char *field_name)
 {
     instance_obj *obj;
-	int i;
-	obj_field *field = NULL;
-	unsigned char *ptr = NULL;
+	field_info *field;
 
     load_reg_to(vm, obj_id, (unsigned char *) &obj); 
-    for (i = 0; i < obj->field_size; i++)
-    {
-        if (!strncmp(field_name, obj->fields[i].name, strlen(field_name)))
-		{
-			field = &obj->fields[i];
-			break;
-		}
-	} 
+    field = find_instance_field(obj->cls, field_name);
     if (!field)
     {
        printf("%s: no field found: %s\n", __FUNCTION__, field_name);
 	   return;
     } 
-	ptr = (unsigned char *) &field->data;
-    load_reg_to_double(vm, val_id, ptr + 4);
-    load_reg_to_double(vm, val_id + 1, ptr);
+    load_reg_to_wide(vm, val_id, instance_data(obj) + field->offset);
 }
 
 void printRegs(simple_dalvik_vm *vm)
 {
     int i = 0;
+    /* the running method owns the topmost window */
+    int size = vm->reg_stack + vm->reg_top - vm->regs;
     if (is_verbose()) {
         printf("pc = %08x\n", vm->pc);
-        for (i = 0; i < 16 ; i++) {
+        for (i = 0; i < size; i++) {
             printf("Reg[%2d] = %4d (%04x) ",
                    i, vm->regs[i], vm->regs[i]);
             if ((i + 1) % 4 == 0) printf("\n");
@@ -404,6 +517,17 @@ void printRegs(simple_dalvik_vm *vm)
     }
 }
 
+/* Print a slot as the hex value of its bytes, most significant first */
+static void print_field(field_info *field, u1 *slot)
+{
+	int i;
+
+	printf(".%s:%s: 0x", field->name, field->type);
+	for (i = field->size - 1; i >= 0; i--)
+		printf("%02x", slot[i]);
+	printf("\n");
+}
+
 void printStaticFields(class_obj *cls)
 {
     int i = 0;
@@ -412,7 +536,7 @@ void printStaticFields(class_obj *cls)
 			printf("Class %x of %s, with fields:\n", cls, cls->name);
 			for (i = 0; i < cls->field_size; i++)
 			{
-				printf(".%s:%s: 0x%x\n", cls->fields[i].name, cls->fields[i].type, cls->fields[i].data);
+				print_field(&cls->fields[i], cls->statics + cls->fields[i].offset);
 			}
 		} while(cls = cls->parent);
 	}
@@ -423,14 +547,14 @@ void printInsFields(instance_obj *obj)
     int i = 0;
     if (is_verbose()) {
 		printf("Instance %x of %s, with fields:\n", obj, obj->cls->name);
-		for (i = 0; i < obj->field_size; i++)
+		for (i = 0; i < obj->cls->ifield_size; i++)
 		{
-			printf(".%s:%s: 0x%x\n", obj->fields[i].name, obj->fields[i].type, obj->fields[i].data);
+			print_field(&obj->cls->ifields[i], instance_data(obj) + obj->cls->ifields[i].offset);
 		}
     }
 }
 
-void printVTable(class_obj *obj)
+void printVTable(DexFileFormat *dex, class_obj *obj)
 {
     int i = 0;
     if (is_verbose()) {
@@ -439,9 +563,11 @@ void printVTable(class_obj *obj)
 		printf("Virtual table of %s:\n", obj->name);
 		for (i = 0; i < obj->vtable_size; i++)
 		{
+			method_id_item *m = get_method_item(dex, obj->vtable[i].method_id);
+
 			printf("vtable[%d].name: %s\n"
 				   "vtable[%d].method_id: %d\n", 
-				   i, obj->vtable[i].name, i, obj->vtable[i].method_id);
+				   i, get_string_data(dex, m->name_idx), i, obj->vtable[i].method_id);
 		}
     }
 }
@@ -482,29 +608,17 @@ int cmp_val(long long val1, long long val2, CMP_TYPE cmp_type)
 
 int cmp_reg(simple_dalvik_vm *vm, int id1, int id2, CMP_TYPE cmp_type)
 {
-	int val1;
-	int val2;
-	load_reg_to(vm, id1, (unsigned char *) &val1);
-	load_reg_to(vm, id2, (unsigned char *) &val2);
-	return cmp_val(val1, val2, cmp_type);
+	return cmp_val(get_reg_int(vm, id1), get_reg_int(vm, id2), cmp_type);
 }
 
 int cmp_reg_z(simple_dalvik_vm *vm, int id, CMP_TYPE cmp_type)
 {
-	int val;
-	load_reg_to(vm, id, (unsigned char *) &val);
-	return cmp_val(val, 0, cmp_type);
+	return cmp_val(get_reg_int(vm, id), 0, cmp_type);
 }
 
 int cmp_reg_long(simple_dalvik_vm *vm, int id1, int id2, CMP_TYPE cmp_type)
 {
-	long long val1;
-	long long val2;
-	load_reg_to_double(vm, id1, (unsigned char *) &val1 + 4);
-	load_reg_to_double(vm, id1 + 1, (unsigned char *) &val1);
-	load_reg_to_double(vm, id2, (unsigned char *) &val2 + 4);
-	load_reg_to_double(vm, id2 + 1, (unsigned char *) &val2);
-	return cmp_val(val1, val2, cmp_type);
+	return cmp_val(get_reg_long(vm, id1), get_reg_long(vm, id2), cmp_type);
 }
 
 void dump_array_wide(instance_obj *array)
@@ -513,15 +627,31 @@ void dump_array_wide(instance_obj *array)
 	array_obj *arr_obj = (array_obj *)array->priv_data;
 
 	printf("array class: %s\n", array->cls->name);
-	for (i = 0; i < arr_obj->size; i += 2)
+	for (i = 0; i < arr_obj->size; i++)
 	{
-		double d;
-		unsigned int *p = (unsigned int *)&d;
-
-		*p = (unsigned int)arr_obj->ptr[i];
-		*(p + 1) = (unsigned int)arr_obj->ptr[i + 1];
+		if (arr_obj->elem == 'D')
+			printf("[%d]: %f\n", i, ((double *)arr_obj->data)[i]);
+		else
+			printf("[%d]: %lld\n", i, ((long long *)arr_obj->data)[i]);
+	}
+}
 
-		printf("[%d]: %f\n", i, d);
+/* Print element i of a 32-bit or narrower array */
+static void dump_element(array_obj *arr_obj, int i)
+{
+	switch (arr_obj->width) {
+	case 1:
+		printf("0x%x", arr_obj->data[i]);
+		break;
+	case 2:
+		printf("0x%x", ((unsigned short *)arr_obj->data)[i]);
+		break;
+	case 4:
+		printf("0x%x", ((unsigned int *)arr_obj->data)[i]);
+		break;
+	default:
+		printf("%p", array_refs(arr_obj)[i]);
+		break;
 	}
 }
 
@@ -532,30 +662,25 @@ void dump_array(instance_obj *array)
 
 	printf("array class: %s\n", array->cls->name);
 	for (i = 0; i < arr_obj->size; i++)
-		printf("[%d]: 0x%x\n", i, arr_obj->ptr[i]);
+	{
+		printf("[%d]: ", i);
+		dump_element(arr_obj, i);
+		printf("\n");
+	}
 }
 
 void __dump_array_dim(array_obj *array, int dimension, int depth)
 {
 	int i;
 
-	if (depth < dimension - 1)
+	for (i = 0; i < array->size; i++)
 	{
-		for (i = 0; i < array->size; i++)
-		{
-			printf("[%d:%d]: 0x%x\n", depth, i, array->ptr[i]);
-			__dump_array_dim(array->ptr[i], dimension, depth + 1);
-		}
-
-	}
-	else
-	{
-		for (i = 0; i < array->size; i++)
-		{
-			printf("[%d:%d]: 0x%x\n", depth, i, array->ptr[i]);
-		}
+		printf("[%d:%d]: ", depth, i);
+		dump_element(array, i);
+		printf("\n");
+		if (depth < dimension - 1)
+			__dump_array_dim(array_refs(array)[i], dimension, depth + 1);
 	}
-
 }
 
 void dump_array_dimension(array_obj *array, int dimension)
@@ -0,0 +1,52 @@
+/*
+ * Allocation-heavy run for the collector.  Short-lived garbage drives
+ * minor collections while a list reachable from a static field survives
+ * them; large arrays, allocated straight into the old generation, then
+ * take the heap past its first full collection.  With a small -Xmx the
+ * arrays kept alive no longer fit and the run ends in OutOfMemoryError.
+ */
+class GCNode {
+    static GCNode head;
+    int val;
+    GCNode next;
+    String s;
+}
+
+class TestGC {
+    public static void main(String args[]) {
+        GCNode[] recent = new GCNode[16];
+        for (int i = 0; i < 20000; i++) {
+            GCNode n = new GCNode();
+            n.val = i;
+            n.next = GCNode.head;
+            n.s = "garbage string";
+            recent[i & 15] = n;
+            new StringBuilder();
+            if ((i & 3) == 0)
+                GCNode.head = n;
+        }
+
+        int sum = 0;
+        int count = 0;
+        for (GCNode n = GCNode.head; n != null; n = n.next) {
+            sum += n.val;
+            count++;
+        }
+        int last = 0;
+        for (int i = 0; i < recent.length; i++)
+            last += recent[i].val;
+        System.out.println("list sum=" + sum + " count=" + count + " recent=" + last);
+
+        int[][] keep = new int[64][];
+        for (int i = 0; i < 400; i++) {
+            int[] big = new int[4096];
+            big[0] = i;
+            big[4095] = i;
+            keep[i & 63] = big;
+        }
+        int kept = 0;
+        for (int i = 0; i < keep.length; i++)
+            kept += keep[i][0] + keep[i][4095];
+        System.out.println("arrays kept=" + kept);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Young objects stored into old ones must outlive minor collections.
+ * Each store below puts a new object into an object, an array or a
+ * static field that already lives in the old generation, through the
+ * bytecodes and through the library, and the nursery is churned before
+ * everything is read back.  Run with a small -Xmn so churn() collects.
+ */
+class NurseryNode {
+    static NurseryNode young;
+    int val;
+    NurseryNode next;
+    StringBuilder sb;
+}
+
+class TestNursery {
+    /* Allocate garbage for a few minor collections */
+    static int churn() {
+        int sum = 0;
+        for (int i = 0; i < 4000; i++) {
+            NurseryNode g = new NurseryNode();
+            g.val = i;
+            sum += g.val;
+        }
+        return sum;
+    }
+
+    static NurseryNode node(int val) {
+        NurseryNode n = new NurseryNode();
+        n.val = val;
+        return n;
+    }
+
+    public static void main(String args[]) {
+        /* big enough to be allocated in the old generation */
+        NurseryNode[] old = new NurseryNode[4096];
+
+        old[0] = node(1);
+        old[0].sb = new StringBuilder("ab");
+        churn();
+        churn();
+
+        /* old[0] and its StringBuilder have been promoted by now */
+        old[0].next = node(2);
+        old[1] = node(3);
+        NurseryNode.young = node(4);
+        NurseryNode[] src = new NurseryNode[2];
+        src[0] = node(5);
+        src[1] = node(6);
+        System.arraycopy(src, 0, old, 2, 2);
+        java.util.Arrays.fill(old, 4, 6, node(7));
+        /* outgrows the builder's String, which is replaced by a young one */
+        old[0].sb.append("0123456789012345678901234567890123456789");
+        churn();
+        churn();
+
+        System.out.println("field=" + old[0].next.val);
+        System.out.println("array=" + old[1].val);
+        System.out.println("static=" + NurseryNode.young.val);
+        System.out.println("arraycopy=" + old[2].val + "," + old[3].val);
+        System.out.println("fill=" + old[4].val + "," + old[5].val);
+        System.out.println("builder=" + old[0].sb.toString());
+    }
+}